@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,27 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so that lookups of different blocks
+// don't contend. A bucket's lock protects the list of buffers
+// in the bucket and their dev, blockno, refcnt and lastuse.
+// Eviction picks the free buffer with the oldest lastuse,
+// locking one bucket at a time.
+//
+// breadahead() starts reads into buffers that it then
+// releases while the disk still owns them (b->disk), so
+// eviction skips such buffers and readers wait for them.
+// virtio_disk_intr() marks a finished read's buffers valid,
+// so they stay useful after no one waits for them.
+//
+// When every buffer is in use or in flight, bevict() sleeps
+// until brelse() or the disk interrupt frees one (bavail()).
+// A process must not wait like that while it holds buffers
+// that others may be waiting for, so code that gets several
+// buffers at a time (bread_range(), breadahead()) asks for
+// the later ones without waiting, and backs off if there are
+// none.
 
 
 #include "types.h"
@@ -22,70 +43,241 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "sysinfo.h"
 
-struct {
+#define NBUCKET 13
+
+struct bucket {
   struct spinlock lock;
+  struct buf head;  // circular list through prev/next
+};
+
+struct {
   struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  uint64 ra_issued;  // blocks read ahead
+  uint64 ra_hit;     // ... later read without another disk read
+  int ra_window;     // blocks readi() reads ahead, up to READAHEAD
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct spinlock waitlock;
+  int nwaiting;      // processes sleeping in bevict()
+  uint freegen;      // bumped by bavail() when someone waits
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev + blockno) % NBUCKET];
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+binsert(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  initlock(&bcache.lock, "bcache");
+  initlock(&bcache.waitlock, "bcache.wait");
+  bcache.ra_window = READAHEAD;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the (not yet valid) buffers over the buckets.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    binsert(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Look for block on device dev in bucket bk, whose lock
+// must be held. If found, take a reference to it.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
+
+// Is block blockno on device dev in the cache?
+static int
+bcached(uint dev, uint blockno)
+{
+  struct bucket *bk = bhash(dev, blockno);
+  struct buf *b;
+  int found = 0;
+
+  acquire(&bk->lock);
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      found = 1;
+  release(&bk->lock);
+  return found;
+}
+
+// Wake processes waiting in bevict(), since a buffer may
+// have become free. Called after the buffer's bucket lock
+// is released, and from the disk interrupt.
+void
+bavail(void)
+{
+  __sync_synchronize();
+  if(bcache.nwaiting == 0)
+    return;
+  acquire(&bcache.waitlock);
+  bcache.freegen++;
+  wakeup(&bcache.freegen);
+  release(&bcache.waitlock);
+}
+
+// Find the least recently used unused buffer, remove it
+// from its bucket and return it with refcnt 1. If there is
+// none, wait for one if wait is set (concurrent readers can
+// briefly tie up every buffer), or else return 0.
+static struct buf*
+bevict(int wait)
+{
+  struct bucket *bk, *bestbk;
+  struct buf *b, *best;
+  int waiting = 0;
+  uint gen = 0;
+
+  for(;;){
+    if(waiting){
+      __sync_synchronize();
+      gen = bcache.freegen;
+    }
+    best = 0;
+    bestbk = 0;
+    for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+      acquire(&bk->lock);
+      for(b = bk->head.next; b != &bk->head; b = b->next){
+        if(b->refcnt == 0 && !b->disk &&
+           (best == 0 || b->lastuse < best->lastuse)){
+          best = b;
+          bestbk = bk;
+        }
+      }
+      release(&bk->lock);
+    }
+    if(best == 0){
+      if(!wait)
+        return 0;
+      if(!waiting){
+        // from now on, bavail() tells us about freed buffers;
+        // look once more before sleeping.
+        __sync_fetch_and_add(&bcache.nwaiting, 1);
+        waiting = 1;
+        continue;
+      }
+      acquire(&bcache.waitlock);
+      if(bcache.freegen == gen)
+        sleep(&bcache.freegen, &bcache.waitlock);
+      release(&bcache.waitlock);
+      continue;
+    }
+
+    // best may have been taken since we looked at it.
+    acquire(&bestbk->lock);
+    if(best->refcnt == 0 && !best->disk){
+      bunlink(best);
+      best->refcnt = 1;
+      release(&bestbk->lock);
+      if(waiting)
+        __sync_fetch_and_sub(&bcache.nwaiting, 1);
+      return best;
+    }
+    release(&bestbk->lock);
+  }
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer, waiting for one to be
+// free if need be and wait is set.
+// In either case, return locked buffer; or 0 if there
+// was no free buffer and wait is clear.
+static struct buf*
+bget(uint dev, uint blockno, int wait)
+{
+  struct bucket *bk = bhash(dev, blockno);
+  struct buf *b, *nb;
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
 
   // Not cached.
   // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((nb = bevict(wait)) == 0)
+    return 0;
+
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    // Another process cached the block while we
+    // weren't holding the lock. Park the recycled
+    // buffer in this bucket, under an identity no
+    // one looks up.
+    nb->dev = 0;
+    nb->blockno = 0;
+    nb->valid = 0;
+    nb->refcnt = 0;
+    binsert(bk, nb);
+    release(&bk->lock);
+    bavail();
+    acquiresleep(&b->lock);
+    return b;
+  }
+  nb->dev = dev;
+  nb->blockno = blockno;
+  nb->valid = 0;
+  nb->readahead = 0;
+  binsert(bk, nb);
+  release(&bk->lock);
+  acquiresleep(&nb->lock);
+  return nb;
+}
+
+// Note that a reader has locked b, counting a read-ahead hit
+// if b was read ahead and needs no disk read of its own.
+// Call before starting a read of b.
+static void
+bused(struct buf *b)
+{
+  if(b->readahead){
+    b->readahead = 0;
+    if(b->valid || b->disk)
+      __sync_fetch_and_add(&bcache.ra_hit, 1);
   }
-  panic("bget: no buffers");
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,14 +286,111 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
-  if(!b->valid) {
-    virtio_disk_rw(b, 0);
-    b->valid = 1;
-  }
+  b = bread_start(dev, blockno);
+  bwait(b);
+  return b;
+}
+
+// Return a locked buf for the indicated block, with a
+// disk read started if the block isn't cached. Call
+// bwait() before using the contents. Starting several
+// reads before waiting keeps them all in flight at once.
+struct buf*
+bread_start(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 1);
+  bused(b);
+  if(!b->valid && !b->disk)
+    virtio_disk_submit(b, 0);
   return b;
 }
 
+// Start disk requests for the n locked buffers in bp[],
+// merging runs of consecutive blocks into one request each.
+// Reads skip buffers that are already valid or being read.
+static void
+bsubmitv(struct buf **bp, int n, int write)
+{
+  int i, j;
+
+  for(i = 0; i < n; i = j){
+    j = i + 1;
+    if(!write && (bp[i]->valid || bp[i]->disk))
+      continue;
+    while(j < n && j - i < MAXIOBLOCKS &&
+          bp[j]->dev == bp[i]->dev &&
+          bp[j]->blockno == bp[i]->blockno + (j - i) &&
+          (write || !(bp[j]->valid || bp[j]->disk)))
+      j++;
+    virtio_disk_submitv(bp + i, j - i, write);
+  }
+}
+
+// Lock a buffer in bp[] for each of the n distinct blocks in
+// blocknos[], and start reading those that aren't cached.
+// Runs of consecutive blocks are read with a single disk
+// request. Call bwait() on each buffer before using it.
+// Callers that lock several buffers at once must do so in
+// ascending block order, to avoid deadlock.
+void
+bread_range(uint dev, uint *blocknos, int n, struct buf **bp)
+{
+  int i, j;
+
+ again:
+  for(i = 0; i < n; i++){
+    if((bp[i] = bget(dev, blocknos[i], i == 0)) == 0){
+      // out of buffers. start reading the blocks we have and
+      // let them go; then, holding nothing, wait for a buffer
+      // for the next one and start it too. they stay cached,
+      // so the next try gets at least one block further.
+      bsubmitv(bp, i, 0);
+      for(j = 0; j < i; j++)
+        brelse(bp[j]);
+      brelse(bread_start(dev, blocknos[i]));
+      goto again;
+    }
+    bused(bp[i]);
+  }
+  bsubmitv(bp, n, 0);
+}
+
+// Start reading the n (at most READAHEAD) distinct blocks in
+// blocknos[], which must ascend, into the cache without
+// waiting for them, so that a later bread() finds them.
+// Blocks already cached or being read are skipped, and
+// read-ahead stops short if there are no free buffers.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  struct buf *bp[READAHEAD], *b;
+  int i, nb;
+
+  if(n > READAHEAD)
+    panic("breadahead");
+  nb = 0;
+  for(i = 0; i < n; i++){
+    // don't wait for the lock of a cached block, whose
+    // holder may itself be waiting for a free buffer.
+    if(bcached(dev, blocknos[i]))
+      continue;
+    if((b = bget(dev, blocknos[i], 0)) == 0)
+      break;
+    if(b->valid || b->disk){
+      brelse(b);
+      continue;
+    }
+    b->readahead = 1;
+    bp[nb++] = b;
+  }
+  bsubmitv(bp, nb, 0);
+  for(i = 0; i < nb; i++)
+    brelse(bp[i]);  // the disk still owns it
+  __sync_fetch_and_add(&bcache.ra_issued, nb);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +400,121 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing b's contents to disk, without waiting.
+// b must be locked, and stay locked until bwait().
+void
+bwrite_start(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_start");
+  virtio_disk_submit(b, 1);
+}
+
+// Start writing the n locked buffers in bp[], merging
+// consecutive blocks into single disk requests. Call
+// bwait() on each buffer before releasing it.
+void
+bwrite_range(struct buf **bp, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bp[i]->lock))
+      panic("bwrite_range");
+  bsubmitv(bp, n, 1);
+}
+
+// Wait for the disk to finish a read or write of the
+// locked buffer b started by one of the *_start functions.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  if(b->disk)
+    virtio_disk_wait(b);
+  b->valid = 1;
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// If no one else is using it, note the time for LRU eviction.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+  int freed;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
-  
-  release(&bcache.lock);
+  // a buffer the disk still owns becomes free at the interrupt.
+  freed = b->refcnt == 0 && !b->disk;
+  release(&bk->lock);
+  if(freed)
+    bavail();
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+  int freed;
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  freed = b->refcnt == 0 && !b->disk;
+  release(&bk->lock);
+  if(freed)
+    bavail();
 }
 
+// Fill in the buffer cache's part of a struct sysinfo.
+void
+bstats(struct sysinfo *info)
+{
+  struct bucket *bk;
 
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    info->bcache_acquire += bk->lock.nacquire;
+    info->bcache_contend += bk->lock.ncontend;
+    release(&bk->lock);
+  }
+  info->ra_issued = bcache.ra_issued;
+  info->ra_hit = bcache.ra_hit;
+  info->ra_window = bcache.ra_window;
+}
+
+// How many blocks readi() keeps read ahead of a sequential reader.
+int
+bwindow(void)
+{
+  return bcache.ra_window;
+}
+
+// Set the read-ahead window to n blocks, 0 (off) to READAHEAD.
+int
+bsetwindow(int n)
+{
+  if(n < 0 || n > READAHEAD)
+    return -1;
+  bcache.ra_window = n;
+  return 0;
+}
@@ -80,7 +80,7 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
+  int c, r;
   char cbuf;
 
   target = n;
@@ -96,6 +96,18 @@ consoleread(int user_dst, uint64 dst, int n)
       sleep(&cons.r, &cons.lock);
     }
 
+    if(user_dst && (n == target || dst % PGSIZE == 0)){
+      // the next byte goes to a new page, which may have to
+      // be faulted in from a file: not while holding cons.lock.
+      release(&cons.lock);
+      r = vmprefault(myproc()->pagetable, dst, 1, 1);
+      acquire(&cons.lock);
+      if(r < 0)
+        break;
+      if(cons.r == cons.w)
+        continue;  // another reader took the input
+    }
+
     c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
 
     if(c == C('D')){  // end-of-file
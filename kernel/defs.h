@@ -8,14 +8,30 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct sysinfo;
+struct kcache;
+struct execseg;
+struct vma;
+struct share;
+struct shm;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bread_start(uint, uint);
+void            bread_range(uint, uint*, int, struct buf**);
+void            breadahead(uint, uint*, int);
+void            bavail(void);
+int             bwindow(void);
+int             bsetwindow(int);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_start(struct buf*);
+void            bwrite_range(struct buf**, int);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bstats(struct sysinfo*);
 
 // console.c
 void            consoleinit(void);
@@ -33,6 +49,8 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int n);
+int             filecopy(struct file*, struct file*, int n);
 
 // fs.c
 void            fsinit(int);
@@ -40,6 +58,7 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            iexec(struct inode*, int);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -61,20 +80,56 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_pages(int);
+void*           kalloc_zeroed(void);
+void            kzeroidle(void);
 void            kfree(void *);
+void            kfree_pages(void*, int);
 void            kinit(void);
+void            kdup(void *);
+int             krefcnt(void *);
+void            kmemstats(struct sysinfo *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
 void            end_op(void);
+void            end_opn(int);
+void            log_sync(void);
+
+// mmap.c
+struct vma*     vmafind(struct proc*, uint64);
+uint64          vmabase(struct proc*);
+uint64          vmafault(struct proc*, struct vma*, uint64, int);
+struct vma*     vmaalloc(uint64);
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+void            vmaclear(struct proc*);
+int             vmacopy(struct proc*, struct proc*);
+void            mmapinit(void);
+void            mapwritei(struct inode*, uint, char*, uint);
+void            maptrunc(struct inode*);
+
+// shm.c
+void            shminit(void);
+int             shmget(int, uint64);
+uint64          shmat(int);
+int             shmdt(uint64);
+int             shmrm(int);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+uint64          shmpage(struct shm*, uint64);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipefill(struct pipe*, struct inode*, uint*, int);
+int             pipedrain(struct pipe*, struct inode*, uint*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -92,6 +147,9 @@ void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
+void            kproc(void (*)(void), char*);
+int             setaffinity(int);
+void            setrunnable(struct proc*);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -118,6 +176,11 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+void            kcache_init(struct kcache*, char*, uint);
+void*           kcache_alloc(struct kcache*);
+void            kcache_free(struct kcache*, void*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -128,6 +191,8 @@ void            initsleeplock(struct sleeplock*, char*);
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
+void            pgzero(void*);
+void            pgcopy(void*, const void*);
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
@@ -141,6 +206,12 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// text.c
+void            textinit(void);
+uint64          textlookup(struct inode *, uint, uint);
+uint64          textpage(struct inode *, uint, uint);
+int             textreclaim(void);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -158,6 +229,13 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            asidinit(void);
+uint64          uvmsatp(struct proc *, int *);
+int             uvmkmap(pagetable_t);
+void            uvmkunmap(pagetable_t);
+void            kvmswitch(void);
+void            uvmswitch(struct proc *);
+int             ucopyfault(uint64, int);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -165,6 +243,10 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
+uint64          vmfault(pagetable_t, uint64, int);
+int             vmprefault(pagetable_t, uint64, uint64, int);
+void            uvmtext(pagetable_t, struct inode *, struct execseg *);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -174,6 +256,9 @@ int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// ucopy.S
+int             ucopy(void *, const void *, uint64);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -183,6 +268,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_submitv(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
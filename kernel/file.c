@@ -12,17 +12,23 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
+
+// open files are allocated from a cache; ftable.lock
+// protects their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  int nfile;            // files allocated, at most NFILE
+  struct kcache cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kcache_init(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -32,15 +38,22 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.nfile >= NFILE){
+    release(&ftable.lock);
+    return 0;
   }
+  ftable.nfile++;
   release(&ftable.lock);
-  return 0;
+
+  if((f = kcache_alloc(&ftable.cache)) == 0){
+    acquire(&ftable.lock);
+    ftable.nfile--;
+    release(&ftable.lock);
+    return 0;
+  }
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +82,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
+  ftable.nfile--;
   release(&ftable.lock);
+  kcache_free(&ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -118,10 +131,35 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // readi()'s copyout() mustn't have to read a page of a
+    // file (maybe f's own) while f->ip is locked. so read a
+    // chunk at a time, faulting in just that part of the
+    // buffer first.
+    int max = 16*BSIZE;
+    int i = 0;
+
+    while(i < n){
+      int n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+
+      if(vmprefault(myproc()->pagetable, addr + i, n1, 1) < 0){
+        r = -1;
+        break;
+      }
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr + i, f->off, n1)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+
+      if(r <= 0)
+        break;
+      i += r;
+      if(r < n1)
+        break;  // end of file
+    }
+    if(i > 0)
+      r = i;
   } else {
     panic("fileread");
   }
@@ -154,11 +192,15 @@ filewrite(struct file *f, uint64 addr, int n)
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
+      // as in fileread().
+      if(vmprefault(myproc()->pagetable, addr + i, n1, 0) < 0)
+        break;
       begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
@@ -180,3 +222,75 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Move up to n bytes from file in to file out inside the
+// kernel, where one is a pipe and the other an inode.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return pipefill(out->pipe, in->ip, &in->off, n);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return pipedrain(in->pipe, out->ip, &out->off, n);
+  return -1;
+}
+
+// Copy up to n bytes from file in to file out, both inodes,
+// without a trip through user space. Each log transaction
+// reserves nearly the whole log, so it can write more blocks
+// than filewrite()'s. Returns the number of bytes copied, which
+// is less than n only at the end of in, or -1.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+  // of the LOGSIZE-1 blocks reserved: data blocks, each with
+  // a bitmap block, plus the inode, the indirect block, and
+  // 2 blocks of slop, as in filewrite().
+  int max = ((LOGSIZE-1-1-1-2) / 2) * BSIZE;
+  int r, w, n1, i = 0;
+  char *mem;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_INODE || out->type != FD_INODE)
+    return -1;
+  if(max > (PGSIZE << COPYORDER))
+    max = PGSIZE << COPYORDER;
+  if((mem = kalloc_pages(COPYORDER)) == 0)
+    return -1;
+
+  while(i < n){
+    n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    // only one inode is locked at a time, so copying a
+    // file to itself, or two copies crossing, can't deadlock.
+    ilock(in->ip);
+    if((r = readi(in->ip, 0, (uint64)mem, in->off, n1)) > 0)
+      in->off += r;
+    iunlock(in->ip);
+    if(r <= 0)
+      break;
+
+    begin_opn(LOGSIZE-1);
+    ilock(out->ip);
+    if((w = writei(out->ip, 0, (uint64)mem, out->off, r)) > 0)
+      out->off += w;
+    iunlock(out->ip);
+    end_opn(LOGSIZE-1);
+
+    if(w != r){
+      i = -1;
+      break;
+    }
+    i += r;
+    if(r < n1)
+      break;
+  }
+  kfree_pages(mem, COPYORDER);
+  return i;
+}
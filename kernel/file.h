@@ -21,6 +21,12 @@ struct inode {
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
+  uint rdoff;         // offset after last readi(), to spot sequential reads
+  uint ranext;        // first block not yet read ahead
+  uint gen;           // changes when the contents do, for text.c
+  int nexec;          // processes running it; writes fail meanwhile
+  struct share *share; // pages of MAP_SHARED mappings; see mmap.c
+
   short type;         // copy of disk inode
   short major;
   short minor;
@@ -26,6 +26,17 @@
 // only one device
 struct superblock sb; 
 
+// source of inode generations (ip->gen).
+static uint igen;
+
+// Give ip a generation no inode has had before, because
+// its contents changed or the table entry is new to it.
+static void
+inewgen(struct inode *ip)
+{
+  ip->gen = __sync_add_and_fetch(&igen, 1);
+}
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -258,7 +269,10 @@ iget(uint dev, uint inum)
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
+    // Remember an empty slot, preferring one that last held
+    // this inode, which keeps its generation.
+    if(ip->ref == 0 &&
+       (empty == 0 || (ip->dev == dev && ip->inum == inum)))
       empty = ip;
   }
 
@@ -267,10 +281,14 @@ iget(uint dev, uint inum)
     panic("iget: no inodes");
 
   ip = empty;
+  if(ip->dev != dev || ip->inum != inum)
+    inewgen(ip);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->rdoff = 0;
+  ip->ranext = 0;
   release(&itable.lock);
 
   return ip;
@@ -287,6 +305,18 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Note that one more process (n = 1) or one fewer (n = -1)
+// runs the program in ip, of which it holds a reference.
+// Running programs are read in from their files a page at a
+// time, so writes to such a file fail (see writei()).
+void
+iexec(struct inode *ip, int n)
+{
+  ilock(ip);
+  ip->nexec += n;
+  iunlock(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -449,6 +479,8 @@ itrunc(struct inode *ip)
   }
 
   ip->size = 0;
+  maptrunc(ip);
+  inewgen(ip);
   iupdate(ip);
 }
 
@@ -464,6 +496,50 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Number of blocks readi() starts reading before
+// waiting for the first, so the disk works on them
+// all at once. Consecutive blocks go to the disk as
+// a single request.
+#define NREADBATCH 8
+
+// A reader has read ip sequentially up to off. Keep up to
+// bwindow() (at most READAHEAD) blocks beyond off on their
+// way into the buffer cache, starting more once half of them
+// have been used. Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off)
+{
+  uint bn, lastbn, addr, window;
+  uint addrs[READAHEAD];
+  int n;
+
+  if((window = bwindow()) == 0)
+    return;
+  bn = (off + BSIZE - 1) / BSIZE;
+  if(bn < ip->ranext){
+    if(ip->ranext - bn > window/2)
+      return;
+    bn = ip->ranext;
+  }
+  lastbn = off/BSIZE + window;
+  if(lastbn > (ip->size + BSIZE - 1) / BSIZE)
+    lastbn = (ip->size + BSIZE - 1) / BSIZE;
+
+  // blocks past the end of the file are never allocated
+  // here, since they are below lastbn. stop at a block that
+  // lies before its predecessor on disk, as in readi().
+  n = 0;
+  for(; bn < lastbn; bn++){
+    addr = bmap(ip, bn);
+    if(addr == 0 || (n > 0 && addr <= addrs[n-1]))
+      break;
+    addrs[n++] = addr;
+  }
+  ip->ranext = bn;
+  if(n > 0)
+    breadahead(ip->dev, addrs, n);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -471,26 +547,59 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, bn, end;
+  int i, nb, err, seq;
+  uint addrs[NREADBATCH];
+  struct buf *bp[NREADBATCH];
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
-      tot = -1;
+  end = off + n;
+  err = 0;
+  seq = (off == ip->rdoff);
+  if(!seq)
+    ip->ranext = 0;  // start read-ahead afresh
+  for(tot=0; tot<n && !err; ){
+    // start reading the next few blocks. stop at one
+    // that lies before its predecessor on disk, since
+    // buffers must be locked in ascending block order.
+    nb = 0;
+    for(bn = off/BSIZE; nb < NREADBATCH && bn*BSIZE < end; bn++){
+      uint addr = bmap(ip, bn);
+      if(addr == 0 || (nb > 0 && addr <= addrs[nb-1]))
+        break;
+      addrs[nb++] = addr;
+    }
+    if(nb == 0)
       break;
+    bread_range(ip->dev, addrs, nb, bp);
+
+    // copy them out in order.
+    for(i = 0; i < nb; i++){
+      bwait(bp[i]);
+      if(!err){
+        m = min(n - tot, BSIZE - off%BSIZE);
+        if(either_copyout(user_dst, dst, bp[i]->data + (off % BSIZE), m) == -1) {
+          tot = -1;
+          err = 1;
+        } else {
+          tot += m;
+          off += m;
+          dst += m;
+        }
+      }
+      brelse(bp[i]);
     }
-    brelse(bp);
+  }
+
+  // read ahead if the reader is moving through the file.
+  if(!err){
+    if(seq)
+      readahead(ip, off);
+    ip->rdoff = off;
   }
   return tot;
 }
@@ -512,6 +621,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->nexec > 0)
+    return -1;  // a running program; see iexec()
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -523,12 +634,15 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    mapwritei(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
 
   if(off > ip->size)
     ip->size = off;
+  if(tot > 0)
+    inewgen(ip);
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
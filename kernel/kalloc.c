@@ -1,6 +1,28 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates blocks of 2^order
+// contiguous 4096-byte pages (order 0..MAXORDER),
+// each aligned to its size; a block of order
+// MEGAPGORDER is a megapage.
+//
+// Free memory is kept by a buddy allocator: a free list
+// per order, where a freed block is merged with its buddy
+// (the other half of the next larger block) whenever that
+// is free too, and a larger block is split to satisfy a
+// smaller request.
+//
+// Single pages also go through a cache of free pages per
+// CPU, so CPUs allocating and freeing them at the same time
+// don't contend for the buddy allocator's lock. A cache is
+// refilled from, and drained to, the buddy allocator KBATCH
+// pages at a time. A CPU whose cache is empty when the
+// buddy allocator has no memory left steals a batch of
+// pages from another CPU's cache.
+//
+// When a CPU has nothing to run, the scheduler calls
+// kzeroidle() to zero free pages into a pool of up to
+// KZEROPOOL pages, from which kalloc_zeroed() hands out
+// pages without having to clear them first.
 
 #include "types.h"
 #include "param.h"
@@ -8,75 +30,531 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "sysinfo.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+#define MAXORDER (NKORDER-1)
+
 struct run {
   struct run *next;
+  struct run *prev;  // only used on the buddy free lists
 };
 
+// most pages taken from another CPU's cache at once.
+#define KSTEAL 64
+
+// pages moved between a CPU's cache and the buddy
+// allocator at once, and the most a cache holds.
+#define KBATCH 32
+#define KCACHE (4*KBATCH)
+
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;         // pages on freelist
+  uint64 nsteal;     // batches stolen from other CPUs
+} kmem[NCPU];
+
+struct {
+  struct spinlock lock;
+  struct run free[NKORDER];  // circular lists of free blocks
+  int nfree[NKORDER];
+} kbuddy;
+
+// most pages kept zeroed in advance.
+#define KZEROPOOL 64
+
+struct {
+  struct spinlock lock;
+  struct run *freelist;  // zeroed pages, except for the link
+  int nfree;
+} kzero;
+
+// index of the physical page pa in kref[] and korder[].
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+// number of page tables (or kernel users) referring
+// to each physical page. copy-on-write fork shares
+// pages, so kfree() only frees a page when its
+// count drops to zero. updated with atomic
+// instructions, so that it needs no lock.
+int kref[(PHYSTOP - KERNBASE) / PGSIZE];
+
+// 1 + the order of the free buddy block that starts at
+// each page, or 0 if none does. protected by kbuddy.lock.
+uchar korder[(PHYSTOP - KERNBASE) / PGSIZE];
+
+// Fill n bytes at pa with junk, but only in a KPOISON build.
+static void
+kpoison(void *pa, int c, uint64 n)
+{
+#ifdef KPOISON
+  memset(pa, c, n);
+#endif
+}
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&kbuddy.lock, "kbuddy");
+  initlock(&kzero.lock, "kzero");
+  for(int k = 0; k < NKORDER; k++){
+    kbuddy.free[k].next = &kbuddy.free[k];
+    kbuddy.free[k].prev = &kbuddy.free[k];
+  }
   freerange(end, (void*)PHYSTOP);
 }
 
+// Free [pa_start, pa_end) in the largest aligned
+// blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  int order;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  while(p + PGSIZE <= (char*)pa_end){
+    order = MAXORDER;
+    while((uint64)p % ((uint64)PGSIZE << order) != 0 ||
+          p + ((uint64)PGSIZE << order) > (char*)pa_end)
+      order--;
+    for(int i = 0; i < (1 << order); i++)
+      kref[PA2PG(p) + i] = 1;
+    kfree_pages(p, order);
+    p += (uint64)PGSIZE << order;
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
-void
-kfree(void *pa)
+// Put the free block r of the given order on its free list.
+// Caller must hold kbuddy.lock.
+static void
+bpush(struct run *r, int order)
+{
+  struct run *h = &kbuddy.free[order];
+
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  kbuddy.nfree[order]++;
+  korder[PA2PG(r)] = order + 1;
+}
+
+// Take the free block r of the given order off its free list.
+// Caller must hold kbuddy.lock.
+static void
+bremove(struct run *r, int order)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kbuddy.nfree[order]--;
+  korder[PA2PG(r)] = 0;
+}
+
+// Free the block of the given order at pa, merging it with
+// its buddy, and the result with its buddy, for as long as
+// the buddy is free. Caller must hold kbuddy.lock.
+static void
+bfree(void *pa, int order)
+{
+  uint64 p = (uint64)pa, b;
+
+  for(; order < MAXORDER; order++){
+    b = p ^ ((uint64)PGSIZE << order);
+    if(b >= PHYSTOP || korder[PA2PG(b)] != order + 1)
+      break;
+    bremove((struct run*)b, order);
+    if(b < p)
+      p = b;
+  }
+  bpush((struct run*)p, order);
+}
+
+// Allocate a block of the given order, splitting a larger
+// one if need be. Returns 0 if none is free.
+// Caller must hold kbuddy.lock.
+static struct run*
+balloc(int order)
 {
   struct run *r;
+  int k;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  for(k = order; k <= MAXORDER && kbuddy.nfree[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kbuddy.free[k].next;
+  bremove(r, k);
+
+  // return the upper halves of the split to the free lists.
+  while(k > order){
+    k--;
+    bpush((struct run*)((char*)r + ((uint64)PGSIZE << k)), k);
+  }
+  return r;
+}
+
+// Drop a reference to each page of the block of 2^order
+// pages at pa, and free the block once the references are
+// gone. pa normally should have been returned by a call to
+// kalloc_pages(order). (The exception is when initializing
+// the allocator; see kinit above.) Blocks of more than one
+// page may not be shared.
+void
+kfree_pages(void *pa, int order)
+{
+  struct run *r, *batch;
+  int id, n;
+
+  if(order < 0 || order > MAXORDER ||
+     ((uint64)pa % ((uint64)PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if(order == 0){
+    if((n = __sync_sub_and_fetch(&kref[PA2PG(pa)], 1)) > 0)
+      return;
+    if(n < 0)
+      panic("kfree: ref");
+  } else {
+    for(int i = 0; i < (1 << order); i++)
+      if(__sync_sub_and_fetch(&kref[PA2PG(pa) + i], 1) != 0)
+        panic("kfree_pages: ref");
+  }
+
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  kpoison(pa, 1, (uint64)PGSIZE << order);
+
+  if(order > 0){
+    acquire(&kbuddy.lock);
+    bfree(pa, order);
+    release(&kbuddy.lock);
+    return;
+  }
 
   r = (struct run*)pa;
+  batch = 0;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  kmem[id].nfree++;
+  if(kmem[id].nfree > KCACHE){
+    // give a batch back, so that it can merge.
+    batch = kmem[id].freelist;
+    for(n = 1, r = batch; n < KBATCH; n++)
+      r = r->next;
+    kmem[id].freelist = r->next;
+    r->next = 0;
+    kmem[id].nfree -= KBATCH;
+  }
+  release(&kmem[id].lock);
+  pop_off();
+
+  if(batch){
+    acquire(&kbuddy.lock);
+    while(batch){
+      r = batch;
+      batch = batch->next;
+      bfree(r, 0);
+    }
+    release(&kbuddy.lock);
+  }
+}
+
+// Free the page of physical memory pointed at by pa;
+// see kfree_pages().
+void
+kfree(void *pa)
+{
+  kfree_pages(pa, 0);
+}
+
+// Take a page from the zeroed pool, and clear the
+// link that the pool kept in it. Returns 0 if the
+// pool is empty.
+static struct run*
+kzerotake(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.nfree--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;
+  return r;
+}
+
+// Move up to KBATCH pages from the buddy allocator to
+// CPU id's cache, and return one more.
+// Called with interrupts off.
+static struct run*
+krefill(int id)
+{
+  struct run *r, *q, *first, *last;
+  int n;
+
+  first = last = 0;
+  acquire(&kbuddy.lock);
+  r = balloc(0);
+  for(n = 0; r && n < KBATCH; n++){
+    if((q = balloc(0)) == 0)
+      break;
+    q->next = first;
+    first = q;
+    if(last == 0)
+      last = q;
+  }
+  release(&kbuddy.lock);
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  if(first){
+    acquire(&kmem[id].lock);
+    last->next = kmem[id].freelist;
+    kmem[id].freelist = first;
+    kmem[id].nfree += n;
+    release(&kmem[id].lock);
+  }
+  return r;
+}
+
+// Take up to half of another CPU's cached pages (at most
+// KSTEAL), keep one, and put the rest on CPU id's list.
+// Only one kmem lock is held at a time.
+// Called with interrupts off.
+static struct run*
+ksteal(int id)
+{
+  struct run *r, *first, *last;
+  int i, n, victim;
+
+  for(i = 1; i < NCPU; i++){
+    victim = (id + i) % NCPU;
+    acquire(&kmem[victim].lock);
+    first = kmem[victim].freelist;
+    if(first == 0){
+      release(&kmem[victim].lock);
+      continue;
+    }
+    n = (kmem[victim].nfree + 1) / 2;
+    if(n > KSTEAL)
+      n = KSTEAL;
+    last = first;
+    for(int j = 1; j < n; j++)
+      last = last->next;
+    kmem[victim].freelist = last->next;
+    kmem[victim].nfree -= n;
+    release(&kmem[victim].lock);
+
+    r = first;
+    acquire(&kmem[id].lock);
+    if(n > 1){
+      last->next = kmem[id].freelist;
+      kmem[id].freelist = first->next;
+      kmem[id].nfree += n - 1;
+    }
+    kmem[id].nsteal++;
+    release(&kmem[id].lock);
+    return r;
+  }
+  return 0;
+}
+
+// Take a free page from this CPU's list, refilling or
+// stealing if it is empty, or from the zeroed pool. Returns 0
+// if there is none.
+static struct run *
+ktake(void)
+{
+  struct run *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r = kmem[id].freelist;
+  if(r){
+    kmem[id].freelist = r->next;
+    kmem[id].nfree--;
+  }
+  release(&kmem[id].lock);
+  if(r == 0)
+    r = krefill(id);
+  if(r == 0)
+    r = ksteal(id);
+  pop_off();
+  if(r == 0)
+    r = kzerotake();
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When memory runs out, frees the pages only the text cache
+// still holds and tries again, so kalloc() takes text.lock
+// then, holding no allocator lock; see text.c.
 void *
 kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  while((r = ktake()) == 0 && textreclaim() > 0)
+    ;
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if(r){
+    kref[PA2PG(r)] = 1;
+    kpoison((char*)r, 5, PGSIZE); // fill with junk
+  }
+  return (void*)r;
+}
+
+// Allocate one zeroed 4096-byte page of physical memory,
+// from the pool kept by kzeroidle() if it isn't empty.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if((r = kzerotake()) != 0){
+    kref[PA2PG(r)] = 1;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    pgzero(r);
   return (void*)r;
 }
+
+// Take a free page for kzeroidle(), from this CPU's list or
+// else the buddy allocator. Unlike ktake(), don't steal from
+// other CPUs or draw on the zeroed pool, and unlike kalloc(),
+// don't reclaim the text cache: an idle CPU should only zero
+// memory that is lying free anyway. Returns 0 if there is none.
+static struct run *
+kidletake(void)
+{
+  struct run *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r = kmem[id].freelist;
+  if(r){
+    kmem[id].freelist = r->next;
+    kmem[id].nfree--;
+  }
+  release(&kmem[id].lock);
+  if(r == 0){
+    acquire(&kbuddy.lock);
+    r = balloc(0);
+    release(&kbuddy.lock);
+  }
+  pop_off();
+  return r;
+}
+
+// Zero a page into the pool for kalloc_zeroed(), if the pool
+// isn't full and a page is free. Called by the scheduler when
+// it has nothing to run, with interrupts on, so zeroing doesn't
+// hold up device interrupts.
+void
+kzeroidle(void)
+{
+  struct run *r;
+
+  if(__atomic_load_n(&kzero.nfree, __ATOMIC_RELAXED) >= KZEROPOOL)
+    return;
+  if((r = kidletake()) == 0)
+    return;
+  pgzero(r);
+
+  acquire(&kzero.lock);
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.nfree++;
+  release(&kzero.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their total size. Each page has one reference.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_pages(int order)
+{
+  struct run *r;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&kbuddy.lock);
+  r = balloc(order);
+  release(&kbuddy.lock);
+
+  if(r){
+    for(int i = 0; i < (1 << order); i++)
+      kref[PA2PG(r) + i] = 1;
+    kpoison((char*)r, 5, (uint64)PGSIZE << order); // fill with junk
+  }
+  return (void*)r;
+}
+
+// Add a reference to an allocated page, e.g. when
+// fork shares it copy-on-write with a child.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+
+  if(__sync_fetch_and_add(&kref[PA2PG(pa)], 1) < 1)
+    panic("kdup: ref");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&kref[PA2PG(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Fill in the allocator's part of a struct sysinfo.
+void
+kmemstats(struct sysinfo *info)
+{
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    info->freemem += (uint64)kmem[i].nfree * PGSIZE;
+    info->kmem_steal += kmem[i].nsteal;
+    info->kmem_acquire += kmem[i].lock.nacquire;
+    info->kmem_contend += kmem[i].lock.ncontend;
+    release(&kmem[i].lock);
+  }
+  acquire(&kbuddy.lock);
+  for(int k = 0; k < NKORDER; k++){
+    info->freemem += (uint64)kbuddy.nfree[k] * (PGSIZE << k);
+    info->kmem_blocks[k] = kbuddy.nfree[k];
+  }
+  info->kmem_acquire += kbuddy.lock.nacquire;
+  info->kmem_contend += kbuddy.lock.ncontend;
+  release(&kbuddy.lock);
+  acquire(&kzero.lock);
+  info->freemem += (uint64)kzero.nfree * PGSIZE;
+  release(&kzero.lock);
+}
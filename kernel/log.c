@@ -19,7 +19,16 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// asks for a commit and sleeps until it is done.
+//
+// Commits are done by the commit daemon, commitd(), not by
+// end_op(). Once a transaction has something in it, the
+// daemon gives other FS system calls COMMITDELAY ticks to
+// join it (group commit), then stops new ones from starting,
+// waits for those in progress to end, and commits. So an FS
+// system call's changes reach the disk shortly after it
+// returns; log_sync() (the fsync() system call) waits until
+// they have.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +37,7 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous within a commit.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,7 +51,12 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks they may still write.
+  int bigwait;     // begin_opn()s for more than MAXOPBLOCKS waiting.
   int committing;  // in commit(), please wait.
+  int urgent;      // someone is waiting for the next commit.
+  uint seq;        // number of the open transaction.
+  uint committed;  // transactions up to this one are on disk.
   int dev;
   struct logheader lh;
 };
@@ -50,6 +64,7 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void commitd(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,24 +76,49 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  kproc(commitd, "commitd");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// MAXIOBLOCKS at a time. Consecutive home blocks go to the
+// disk in a single request. When not recovering, the pinned
+// cache blocks already hold the committed contents.
 static void
 install_trans(int recovering)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  uint blocknos[MAXIOBLOCKS];
+  struct buf *lbuf[MAXIOBLOCKS], *dbuf[MAXIOBLOCKS];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > MAXIOBLOCKS)
+      n = MAXIOBLOCKS;
+    if(recovering){
+      for (i = 0; i < n; i++)
+        blocknos[i] = log.start+tail+1+i;
+      bread_range(log.dev, blocknos, n, lbuf); // read log blocks
+    }
+    for (i = 0; i < n; i++)
+      blocknos[i] = log.lh.block[tail+i];
+    bread_range(log.dev, blocknos, n, dbuf); // read dst
+    for (i = 0; i < n; i++){
+      bwait(dbuf[i]);
+      if(recovering){
+        bwait(lbuf[i]);
+        memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+        brelse(lbuf[i]);
+      }
+    }
+    bwrite_range(dbuf, n);  // write dst to disk
+    for (i = 0; i < n; i++){
+      bwait(dbuf[i]);
+      if(recovering == 0)
+        bunpin(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -122,19 +162,56 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+// Ask the commit daemon to commit the open transaction
+// without waiting for more operations to join it.
+// Caller must hold log.lock.
+static void
+log_kick(void)
+{
+  log.urgent = 1;
+  wakeup(&log);
+  acquire(&tickslock);
+  wakeup(&ticks);
+  release(&tickslock);
+}
+
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// start an FS operation that may write up to n blocks,
+// for n up to LOGSIZE-1; end it with end_opn(n).
+// an operation that needs more than MAXOPBLOCKS may have
+// to wait for the log to empty, so while one waits, new
+// ordinary operations wait too rather than keep it filled.
+void
+begin_opn(int n)
+{
+  int big = 0;
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > LOGSIZE){
       // this op might exhaust log space; wait for commit.
+      if(n > MAXOPBLOCKS && !big){
+        big = 1;
+        log.bigwait++;
+      }
+      log_kick();
+      sleep(&log, &log.lock);
+    } else if(n <= MAXOPBLOCKS && log.bigwait > 0){
+      // let the big one in first.
       sleep(&log, &log.lock);
     } else {
+      if(big && --log.bigwait == 0)
+        wakeup(&log);
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
@@ -142,51 +219,129 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// leaves the commit to commitd().
 void
 end_op(void)
 {
-  int do_commit = 0;
+  end_opn(MAXOPBLOCKS);
+}
 
+void
+end_opn(int n)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  log.reserved -= n;
+  // begin_op() may be waiting for log space, and
+  // decrementing log.reserved has decreased the
+  // amount of reserved space. commitd() may be waiting
+  // for a transaction to fill, or for its last
+  // operation to end.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Wait until the changes of all FS system calls that
+// have ended are on disk.
+void
+log_sync(void)
+{
+  uint want;
+
+  acquire(&log.lock);
+  want = log.seq;
+  if(log.lh.n == 0 && !log.committing)
+    want = log.committed;  // nothing new to commit
+  while(log.committed < want){
+    log_kick();
+    sleep(&log, &log.lock);
   }
   release(&log.lock);
+}
+
+// The commit daemon, a kernel process.
+static void
+commitd(void)
+{
+  uint t0;
+
+  acquire(&log.lock);
+  for(;;){
+    while(log.lh.n == 0)
+      sleep(&log, &log.lock);
+    release(&log.lock);
+
+    // give more operations a chance to join the
+    // transaction, unless someone is waiting for it.
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < COMMITDELAY && !log.urgent)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    // close the transaction and wait for the
+    // operations in it to end.
+    acquire(&log.lock);
+    log.committing = 1;
+    log.urgent = 0;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    release(&log.lock);
 
-  if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
+
     acquire(&log.lock);
+    log.seq++;
     log.committing = 0;
     wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log, writing
+// up to MAXIOBLOCKS log blocks per disk request.
 static void
 write_log(void)
 {
-  int tail;
+  uint blocknos[MAXIOBLOCKS];
+  struct buf *to[MAXIOBLOCKS];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > MAXIOBLOCKS)
+      n = MAXIOBLOCKS;
+    for (i = 0; i < n; i++)
+      blocknos[i] = log.start+tail+1+i;
+    bread_range(log.dev, blocknos, n, to); // log blocks
+    for (i = 0; i < n; i++){
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      bwait(to[i]);
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwrite_range(to, n);  // write the log
+    for (i = 0; i < n; i++){
+      bwait(to[i]);
+      brelse(to[i]);
+    }
+  }
+}
+
+// Sort the logged block numbers, so that install_trans()
+// locks the home blocks in ascending order (as readi()
+// does) and can merge consecutive ones.
+static void
+sort_log(void)
+{
+  int i, j, b;
+
+  for (i = 1; i < log.lh.n; i++) {
+    b = log.lh.block[i];
+    for (j = i; j > 0 && log.lh.block[j-1] > b; j--)
+      log.lh.block[j] = log.lh.block[j-1];
+    log.lh.block[j] = b;
   }
 }
 
@@ -194,8 +349,13 @@ static void
 commit()
 {
   if (log.lh.n > 0) {
+    sort_log();      // Order the blocks for install_trans()
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
+    acquire(&log.lock);
+    log.committed = log.seq;
+    wakeup(&log);    // log_sync() callers needn't wait for the rest
+    release(&log.lock);
     install_trans(0); // Now install writes to home locations
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
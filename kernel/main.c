@@ -19,6 +19,7 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space IDs
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
@@ -27,6 +28,10 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    mmapinit();      // MAP_SHARED page sets
+    textinit();      // text page cache
+    shminit();       // shared-memory segments
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -65,3 +65,12 @@
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// user memory lies below USERTOP. When the kernel is mapped
+// into every user page table (make KSHARED=1), that must be
+// clear of the lowest kernel mapping, the PLIC.
+#ifdef KSHARED
+#define USERTOP PLIC
+#else
+#define USERTOP TRAPFRAME
+#endif
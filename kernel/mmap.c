@@ -0,0 +1,557 @@
+//
+// Memory-mapped files and anonymous memory.
+//
+// mmap() only records a region (struct vma) in the process;
+// vmfault() sends faults in it to vmafault(), which maps a
+// zeroed page or one read from the file. Regions are placed
+// top-down from USERTOP, and sbrk() may not grow into them.
+//
+// Pages of a MAP_PRIVATE region are the process's own, and are
+// copy-on-write across fork(). The pages of a MAP_SHARED region
+// are kept in a struct share, filled in as they're first touched.
+// Every MAP_SHARED mapping of a file uses the file's one share
+// (ip->share), and the copies fork() makes of an anonymous region
+// use its share, so a page is shared even if no one touched it
+// before the fork. For a file, a page is mapped read-only until the
+// first store to it, which vmfault() notes with PTE_D, and munmap()
+// (or exit or exec) writes the pages a process dirtied back to the
+// file. write() updates the shared pages too (see mapwritei()),
+// so write-back never undoes it, but read() sees stores to mapped
+// pages only once they're written back. shmat() maps a segment
+// made by shmget() as a MAP_SHARED region whose pages are the
+// segment's.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "slab.h"
+
+#define SHNENT (PGSIZE / sizeof(uint64))  // entries per table page
+#define SHMAXPAGES (SHNENT * SHNENT)
+
+// The pages of a file's MAP_SHARED mappings, or of an anonymous
+// MAP_SHARED region and its copies, indexed by file (or region)
+// offset / PGSIZE through a two-level table: dir points to pages
+// of physical addresses, allocated as needed.
+struct share {
+  struct spinlock lock;  // protects dir and the tables
+  int ref;               // regions using it
+  struct inode *ip;      // the file, or 0
+  uint64 **dir;          // a page of SHNENT table pointers
+};
+
+struct kcache sharecache;
+
+void
+mmapinit(void)
+{
+  kcache_init(&sharecache, "share", sizeof(struct share));
+}
+
+// Allocate a share for ip (or anonymous memory, if 0)
+// with one reference. Returns 0 if out of memory.
+static struct share *
+sharealloc(struct inode *ip)
+{
+  struct share *sh;
+
+  if((sh = kcache_alloc(&sharecache)) == 0)
+    return 0;
+  if((sh->dir = kalloc_zeroed()) == 0){
+    kcache_free(&sharecache, sh);
+    return 0;
+  }
+  initlock(&sh->lock, "share");
+  sh->ref = 1;
+  sh->ip = ip;
+  return sh;
+}
+
+// Return a reference to the share of ip's MAP_SHARED
+// mappings, making it if there are none. Returns 0
+// if out of memory.
+static struct share *
+shareget(struct inode *ip)
+{
+  struct share *sh;
+
+  ilock(ip);
+  if((sh = ip->share) != 0)
+    __sync_fetch_and_add(&sh->ref, 1);
+  else
+    sh = ip->share = sharealloc(ip);
+  iunlock(ip);
+  return sh;
+}
+
+// Drop a reference to sh, freeing it and its pages with
+// the last one. A file's share goes under the inode's lock,
+// so that shareget() never finds one being freed.
+static void
+shareput(struct share *sh)
+{
+  uint64 *t;
+  int i, j, last;
+
+  if(sh->ip)
+    ilock(sh->ip);
+  last = __sync_sub_and_fetch(&sh->ref, 1) == 0;
+  if(last && sh->ip)
+    sh->ip->share = 0;
+  if(sh->ip)
+    iunlock(sh->ip);
+  if(!last)
+    return;
+
+  for(i = 0; i < SHNENT; i++){
+    if((t = sh->dir[i]) == 0)
+      continue;
+    for(j = 0; j < SHNENT; j++)
+      if(t[j])
+        kfree((void*)t[j]);
+    kfree(t);
+  }
+  kfree(sh->dir);
+  kcache_free(&sharecache, sh);
+}
+
+// Return the physical address of page i of sh, or 0
+// if it hasn't been filled in.
+static uint64
+sharepage(struct share *sh, uint64 i)
+{
+  uint64 pa = 0;
+
+  acquire(&sh->lock);
+  if(sh->dir[i / SHNENT])
+    pa = sh->dir[i / SHNENT][i % SHNENT];
+  release(&sh->lock);
+  return pa;
+}
+
+// Make pa page i of sh, unless someone else filled it in
+// first. Returns the page sh ends up with (if not pa, the
+// caller should free pa), or 0 if out of memory. sh takes
+// over the caller's reference to pa if it keeps it.
+static uint64
+sharefill(struct share *sh, uint64 i, uint64 pa)
+{
+  uint64 *t = 0;
+
+  if(sh->dir[i / SHNENT] == 0 && (t = kalloc_zeroed()) == 0)
+    return 0;
+  acquire(&sh->lock);
+  if(sh->dir[i / SHNENT] == 0){
+    sh->dir[i / SHNENT] = t;
+    t = 0;
+  }
+  if(sh->dir[i / SHNENT][i % SHNENT] == 0)
+    sh->dir[i / SHNENT][i % SHNENT] = pa;
+  pa = sh->dir[i / SHNENT][i % SHNENT];
+  release(&sh->lock);
+  if(t)
+    kfree(t);
+  return pa;
+}
+
+// writei() has written the n bytes at src to ip at off; copy
+// them into the pages of ip's MAP_SHARED mappings, so that
+// the mappings see the write, and writing those pages back
+// doesn't undo it. Caller holds ip->lock.
+void
+mapwritei(struct inode *ip, uint off, char *src, uint n)
+{
+  uint64 pa;
+  uint m;
+
+  if(ip->share == 0)
+    return;
+  for(; n > 0; n -= m, off += m, src += m){
+    m = PGSIZE - off % PGSIZE;
+    if(m > n)
+      m = n;
+    if(off / PGSIZE >= SHMAXPAGES)
+      break;
+    if((pa = sharepage(ip->share, off / PGSIZE)) != 0)
+      memmove((char*)pa + off % PGSIZE, src, m);
+  }
+}
+
+// ip has been truncated; clear the pages of its MAP_SHARED
+// mappings, which now lie past its end. Caller holds ip->lock.
+void
+maptrunc(struct inode *ip)
+{
+  uint64 *t;
+  int i, j;
+
+  if(ip->share == 0)
+    return;
+  acquire(&ip->share->lock);
+  for(i = 0; i < SHNENT; i++){
+    if((t = ip->share->dir[i]) == 0)
+      continue;
+    for(j = 0; j < SHNENT; j++)
+      if(t[j])
+        memset((void*)t[j], 0, PGSIZE);
+  }
+  release(&ip->share->lock);
+}
+
+// Return p's region that contains va, or 0.
+struct vma *
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma + NVMA; v++)
+    if(v->len != 0 && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Return the lowest address of p's regions, which the
+// heap must stay below, or USERTOP if there are none.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = USERTOP;
+
+  for(v = p->vma; v < p->vma + NVMA; v++)
+    if(v->len != 0 && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Map the page at va of region v. Returns the page's
+// physical address, or 0 if the access isn't allowed
+// or memory is exhausted.
+uint64
+vmafault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  struct inode *ip = v->f ? v->f->ip : 0;
+  char *mem;
+  uint64 pa;
+  uint off, n;
+  int perm;
+
+  if((v->prot & PROT_READ) == 0 || (write && (v->prot & PROT_WRITE) == 0))
+    return 0;
+  off = v->off + (va - v->addr);
+
+  if(v->shm){
+    // the segment's own page.
+    if((mem = (char*)shmpage(v->shm, off / PGSIZE)) == 0)
+      return 0;
+    kdup(mem);
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_D|PTE_U) != 0){
+      kfree(mem);
+      return 0;
+    }
+    return (uint64)mem;
+  }
+
+  perm = PTE_R | PTE_U;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v->prot & PROT_WRITE){
+    // a shared file page becomes writable (and dirty) at the
+    // first store to it; see vmfault().
+    if(v->f == 0 || (v->flags & MAP_PRIVATE) || write)
+      perm |= PTE_W | PTE_D;
+  }
+
+  // holding a file's lock keeps another process from filling
+  // in the same shared page, and write() from changing it,
+  // while this one reads it in.
+  if(ip)
+    ilock(ip);
+  if(v->share == 0 || (pa = sharepage(v->share, off / PGSIZE)) == 0){
+    if((mem = kalloc()) == 0)
+      goto bad;
+    n = 0;
+    if(ip && off < ip->size){
+      n = ip->size - off;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      if(readi(ip, 0, (uint64)mem, off, n) != n){
+        kfree(mem);
+        goto bad;
+      }
+    }
+    memset(mem + n, 0, PGSIZE - n);
+    pa = (uint64)mem;
+    if(v->share && (pa = sharefill(v->share, off / PGSIZE, pa)) != (uint64)mem){
+      // out of memory, or another process sharing an
+      // anonymous region got there first.
+      kfree(mem);
+      if(pa == 0)
+        goto bad;
+    }
+  }
+  if(v->share)
+    kdup((void*)pa);  // the share keeps its own reference
+  if(ip)
+    iunlock(ip);
+
+  if(mappages(p->pagetable, va, PGSIZE, pa, perm) != 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  return pa;
+
+ bad:
+  if(ip)
+    iunlock(ip);
+  return 0;
+}
+
+// Take another reference to what region v maps.
+static void
+vmadup(struct vma *v)
+{
+  if(v->f)
+    filedup(v->f);
+  if(v->share)
+    __sync_fetch_and_add(&v->share->ref, 1);
+  if(v->shm)
+    shmdup(v->shm);
+}
+
+// Drop region v's reference to what it maps, and free v.
+static void
+vmafree(struct vma *v)
+{
+  if(v->share)
+    shareput(v->share);  // before the file's inode can go
+  if(v->f)
+    fileclose(v->f);
+  if(v->shm)
+    shmput(v->shm);
+  v->len = 0;
+  v->f = 0;
+  v->share = 0;
+  v->shm = 0;
+}
+
+// Write the dirty pages of shared file region v from va
+// up to end back to the file, as far as it extends.
+static void
+vmawriteback(struct proc *p, struct vma *v, uint64 va, uint64 end)
+{
+  struct inode *ip = v->f->ip;
+  pte_t *pte;
+  uint off, n;
+
+  for(; va < end; va += PGSIZE){
+    pte = walk(p->pagetable, va, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    off = v->off + (va - v->addr);
+    begin_op();
+    ilock(ip);
+    if(off < ip->size){
+      n = ip->size - off;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      writei(ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Remove [va, end) of region v from p's address space,
+// writing back what needs it. The caller adjusts v.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 end)
+{
+  if(v->f && (v->flags & MAP_SHARED) && (v->prot & PROT_WRITE))
+    vmawriteback(p, v, va, end);
+  uvmunmap(p->pagetable, va, (end - va) / PGSIZE, 1);
+}
+
+// Find room for a region of len bytes, a multiple of PGSIZE,
+// in the current process, in the highest gap below USERTOP.
+// Returns a free struct vma with addr and len set, or 0.
+struct vma *
+vmaalloc(uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free = 0;
+  uint64 top;
+
+  for(v = p->vma; v < p->vma + NVMA; v++)
+    if(v->len == 0){
+      free = v;
+      break;
+    }
+  if(free == 0)
+    return 0;
+
+  top = USERTOP;
+ again:
+  if(top < len)
+    return 0;
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->len != 0 && v->addr < top && v->addr + v->len > top - len){
+      top = v->addr;
+      goto again;
+    }
+  }
+  if(top - len < PGROUNDUP(p->sz))
+    return 0;
+
+  free->addr = top - len;
+  free->len = len;
+  free->f = 0;
+  free->share = 0;
+  free->shm = 0;
+  free->off = 0;
+  return free;
+}
+
+// Map len bytes of f from off, or anonymous memory if f is 0,
+// somewhere in the current process. Returns the address,
+// or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct vma *v;
+  struct share *sh = 0;
+
+  if(len == 0 || len > USERTOP || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  if(flags & MAP_SHARED){
+    if(off / PGSIZE + PGROUNDUP(len) / PGSIZE > SHMAXPAGES)
+      return -1;
+    if((sh = f ? shareget(f->ip) : sharealloc(0)) == 0)
+      return -1;
+  }
+  if((v = vmaalloc(PGROUNDUP(len))) == 0){
+    if(sh)
+      shareput(sh);
+    return -1;
+  }
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->share = sh;
+  v->off = off;
+  return v->addr;
+}
+
+// Unmap [addr, addr+len) from the current process, which
+// may cover parts of several regions. A region left in two
+// pieces needs a free struct vma. Returns 0, or -1.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *w;
+  uint64 end, lo, hi;
+  int nfree = 0, nsplit = 0;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr >= USERTOP || len > USERTOP - addr)
+    return -1;
+  end = addr + PGROUNDUP(len);
+
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->len == 0)
+      nfree++;
+    else if(addr > v->addr && end < v->addr + v->len)
+      nsplit++;
+  }
+  if(nsplit > nfree)
+    return -1;
+
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->len == 0 || end <= v->addr || addr >= v->addr + v->len)
+      continue;
+    lo = addr > v->addr ? addr : v->addr;
+    hi = end < v->addr + v->len ? end : v->addr + v->len;
+    vmaunmap(p, v, lo, hi);
+    if(lo > v->addr && hi < v->addr + v->len){
+      // punched a hole; the part above it gets a new vma.
+      for(w = p->vma; w->len != 0; w++)
+        ;
+      *w = *v;
+      w->addr = hi;
+      w->len = v->addr + v->len - hi;
+      w->off = v->off + (hi - v->addr);
+      vmadup(w);
+      v->len = lo - v->addr;
+    } else if(lo > v->addr){
+      v->len = lo - v->addr;
+    } else if(hi < v->addr + v->len){
+      v->off += hi - v->addr;
+      v->len -= hi - v->addr;
+      v->addr = hi;
+    } else {
+      vmafree(v);
+    }
+  }
+  return 0;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+vmaclear(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap(p, v, v->addr, v->addr + v->len);
+    vmafree(v);
+  }
+}
+
+// Give fork()'s child np copies of p's regions, sharing
+// the pages of MAP_SHARED ones and copying the rest on
+// write, as uvmcopy() does. Returns 0, or -1 with nothing
+// left mapped in np.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    if(v->len == 0)
+      continue;
+    if(uvmcopyrange(p->pagetable, np->pagetable, v->addr, v->addr + v->len,
+                    (v->flags & MAP_SHARED) != 0) != 0){
+      while(--v >= p->vma)
+        if(v->len != 0)
+          uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+      return -1;
+    }
+  }
+  for(v = p->vma; v < p->vma + NVMA; v++){
+    np->vma[v - p->vma] = *v;
+    if(v->len != 0)
+      vmadup(v);
+  }
+  return 0;
+}
@@ -6,8 +6,16 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NEXECSEG      4  // max loadable segments in a program
+#define NVMA         16  // mmap()ed regions per process
+#define NSHM         16  // shared-memory segments per system
+#define PIPEORDER     0  // a pipe buffers 2^PIPEORDER pages
+#define COPYORDER     2  // copy_file_range() buffers 2^COPYORDER pages
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define COMMITDELAY  1   // ticks a transaction waits for more FS ops
+#define NBUF         (MAXOPBLOCKS*10) // size of disk block cache
+#define MAXIOBLOCKS  16  // max blocks in one disk request
+#define READAHEAD    16  // max blocks read ahead of a sequential reader
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
@@ -7,18 +7,29 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
-#define PIPESIZE 512
+#define PIPESIZE (PGSIZE << PIPEORDER)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // ring of PIPESIZE bytes, 2^PIPEORDER pages
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  uint rbusy;     // a reader is copying out data at nread
+  uint wbusy;     // a writer is copying in data at nwrite
 };
 
+struct kcache pipecache;
+
+void
+pipeinit(void)
+{
+  kcache_init(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +39,16 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kcache_alloc(&pipecache)) == 0)
+    goto bad;
+  if((pi->data = kalloc_pages(PIPEORDER)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->rbusy = 0;
+  pi->wbusy = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -46,8 +61,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    if(pi->data)
+      kfree_pages(pi->data, PIPEORDER);
+    kcache_free(&pipecache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +86,27 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kfree_pages(pi->data, PIPEORDER);
+    kcache_free(&pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Readers sleep only on an empty pipe and writers only on a full
+// one, so a writer wakes readers only if it found the pipe empty,
+// and a reader wakes writers only if it found the pipe full.
+// Data moves with one copyin() or copyout() per contiguous span
+// of the ring, made without the lock, since the copy may have to
+// fault in a user page, perhaps reading it from a file. Meanwhile
+// the pipe is marked busy, so that other writers, or other
+// readers, wait; pipefill() and pipedrain() do the same to move
+// a span between the ring and the buffer cache.
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m, r;
+  uint off;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,18 +115,33 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    if(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+      sleep(pi->wbusy ? &pi->wbusy : &pi->nwrite, &pi->lock);
+      continue;
     }
+    // up to the end of the free space or of the ring.
+    off = pi->nwrite % PIPESIZE;
+    m = pi->nread + PIPESIZE - pi->nwrite;
+    if(m > PIPESIZE - off)
+      m = PIPESIZE - off;
+    if(m > n - i)
+      m = n - i;
+    pi->wbusy = 1;
+    release(&pi->lock);
+
+    // readers don't look past nwrite, so the span is ours.
+    r = copyin(pr->pagetable, pi->data + off, addr + i, m);
+
+    acquire(&pi->lock);
+    pi->wbusy = 0;
+    wakeup(&pi->wbusy);
+    if(r == -1)
+      break;
+    if(pi->nwrite == pi->nread)
+      wakeup(&pi->nread);
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
@@ -105,26 +150,144 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m, r;
+  uint off;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
-    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    sleep(pi->rbusy ? &pi->rbusy : &pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  pi->rbusy = 1;
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % PIPESIZE;
+    m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - off)
+      m = PIPESIZE - off;
+    if(m > n - i)
+      m = n - i;
+    release(&pi->lock);
+
+    // writers don't touch the ring before nread, so the span is ours.
+    r = copyout(pr->pagetable, addr + i, pi->data + off, m);
+
+    acquire(&pi->lock);
+    if(r == -1)
       break;
+    if(pi->nwrite == pi->nread + PIPESIZE)
+      wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pi->rbusy = 0;
+  wakeup(&pi->rbusy);
   release(&pi->lock);
   return i;
 }
+
+// Read up to n bytes of ip from *off straight from the buffer
+// cache into pi, as one span of the ring, and advance *off.
+// Waits for room. Returns the number of bytes moved, 0 at
+// the end of the file, or -1.
+int
+pipefill(struct pipe *pi, struct inode *ip, uint *off, int n)
+{
+  struct proc *pr = myproc();
+  uint roff;
+  int m, r;
+
+  acquire(&pi->lock);
+  for(;;){
+    if(pi->readopen == 0 || killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    if(!pi->wbusy && pi->nwrite != pi->nread + PIPESIZE)
+      break;
+    sleep(pi->wbusy ? &pi->wbusy : &pi->nwrite, &pi->lock);
+  }
+  roff = pi->nwrite % PIPESIZE;
+  m = pi->nread + PIPESIZE - pi->nwrite;
+  if(m > PIPESIZE - roff)
+    m = PIPESIZE - roff;
+  if(m > n)
+    m = n;
+  pi->wbusy = 1;
+  release(&pi->lock);
+
+  // readers don't look past nwrite, so the span is ours.
+  ilock(ip);
+  if((r = readi(ip, 0, (uint64)pi->data + roff, *off, m)) > 0)
+    *off += r;
+  iunlock(ip);
+
+  acquire(&pi->lock);
+  if(r > 0){
+    if(pi->nwrite == pi->nread)
+      wakeup(&pi->nread);
+    pi->nwrite += r;
+  }
+  pi->wbusy = 0;
+  wakeup(&pi->wbusy);
+  release(&pi->lock);
+  return r;
+}
+
+// Write up to n bytes from pi, as one span of the ring, straight
+// into ip at *off through the buffer cache, and advance *off.
+// Waits for data. Returns the number of bytes moved, 0 if the
+// pipe is empty and closed for writing, or -1.
+int
+pipedrain(struct pipe *pi, struct inode *ip, uint *off, int n)
+{
+  // as much as filewrite() writes in one transaction.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct proc *pr = myproc();
+  uint roff;
+  int m, r;
+
+  acquire(&pi->lock);
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){
+    if(killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(pi->rbusy ? &pi->rbusy : &pi->nread, &pi->lock);
+  }
+  roff = pi->nread % PIPESIZE;
+  m = pi->nwrite - pi->nread;
+  if(m > PIPESIZE - roff)
+    m = PIPESIZE - roff;
+  if(m > n)
+    m = n;
+  if(m > max)
+    m = max;
+  if(m == 0){
+    release(&pi->lock);
+    return 0;
+  }
+  pi->rbusy = 1;
+  release(&pi->lock);
+
+  // writers don't touch the ring before nread, so the span is ours.
+  begin_op();
+  ilock(ip);
+  if((r = writei(ip, 0, (uint64)pi->data + roff, *off, m)) > 0)
+    *off += r;
+  iunlock(ip);
+  end_op();
+
+  acquire(&pi->lock);
+  if(r > 0){
+    if(pi->nwrite == pi->nread + PIPESIZE)
+      wakeup(&pi->nwrite);
+    pi->nread += r;
+  }
+  pi->rbusy = 0;
+  wakeup(&pi->rbusy);
+  release(&pi->lock);
+  return r > 0 ? r : -1;
+}
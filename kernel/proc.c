@@ -12,10 +12,41 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Per-CPU queues of RUNNABLE processes, linked through
+// p->rqnext. A process is on a queue only while it is
+// RUNNABLE, and on at most one queue.
+// A run queue lock may be acquired while holding a p->lock,
+// but not the other way around.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int n;              // number of processes on the queue
+} runq[NCPU];
+
+// Processes in sleep(), hashed by wait channel into
+// NWAITQ wait queues linked through p->wqnext, so that
+// wakeup() only looks at processes that might be
+// sleeping on its channel.
+// Lock order: a sleep() caller's lock, then a wait queue
+// lock, then p->lock.
+#define NWAITQ 61
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+static struct waitq*
+chanq(void *chan)
+{
+  return &waitq[(uint64)chan % NWAITQ];
+}
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kprocstart(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -51,6 +82,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +159,8 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->affinity = ~0;
+  p->asidgen = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -165,9 +202,12 @@ freeproc(struct proc *p)
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
-  p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
+  p->nseg = 0;
+  p->cpu = 0;
+  p->affinity = 0;
   p->state = UNUSED;
 }
 
@@ -202,6 +242,14 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+#ifdef KSHARED
+  // map the kernel too, so that traps needn't switch page tables.
+  if(uvmkmap(pagetable) < 0){
+    proc_freepagetable(pagetable, 0);
+    return 0;
+  }
+#endif
+
   return pagetable;
 }
 
@@ -210,6 +258,9 @@ proc_pagetable(struct proc *p)
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
+#ifdef KSHARED
+  uvmkunmap(pagetable);
+#endif
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
   uvmfree(pagetable, sz);
@@ -249,7 +300,25 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&p->lock);
+}
+
+// Start a kernel process, which runs fn() in the kernel
+// and never returns to user space. fn() must not return.
+void
+kproc(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  p->kfn = fn;
+  p->context.ra = (uint64)kprocstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  setrunnable(p);
 
   release(&p->lock);
 }
@@ -264,9 +333,11 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // don't allocate anything yet; vmfault() maps a
+    // zeroed page when the process first touches it.
+    if(sz + n > vmabase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -296,6 +367,13 @@ fork(void)
   }
   np->sz = p->sz;
 
+  // and its mmap()ed regions.
+  if(vmacopy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -307,19 +385,29 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->execip)
+    np->execip = idup(p->execip);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->cpu = p->cpu;
+  np->affinity = p->affinity;
+
   pid = np->pid;
 
   release(&np->lock);
 
+  if(np->execip)
+    iexec(np->execip, 1);
+
   acquire(&wait_lock);
   np->parent = p;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -351,6 +439,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and unmap mmap()ed regions.
+  vmaclear(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -360,10 +451,15 @@ exit(int status)
     }
   }
 
+  if(p->execip)
+    iexec(p->execip, -1);
   begin_op();
   iput(p->cwd);
+  if(p->execip)
+    iput(p->execip);
   end_op();
   p->cwd = 0;
+  p->execip = 0;
 
   acquire(&wait_lock);
 
@@ -394,6 +490,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // copyout() below runs holding spinlocks.
+  if(addr != 0 && vmprefault(p->pagetable, addr, sizeof(int), 1) < 0)
+    return -1;
+
   acquire(&wait_lock);
 
   for(;;){
@@ -434,10 +534,99 @@ wait(uint64 addr)
   }
 }
 
+// Choose the run queue for p: the CPU it last ran on,
+// if p's affinity allows it, else the least loaded CPU
+// that p may run on.
+static int
+pickcpu(struct proc *p)
+{
+  int i, best = -1;
+
+  if(cpus[p->cpu].online && (p->affinity & (1 << p->cpu)))
+    return p->cpu;
+  for(i = 0; i < NCPU; i++){
+    if(!cpus[i].online || (p->affinity & (1 << i)) == 0)
+      continue;
+    if(best < 0 || runq[i].n < runq[best].n)
+      best = i;
+  }
+  if(best < 0)
+    best = cpuid(); // still booting
+  return best;
+}
+
+// Mark p RUNNABLE and put it on a run queue.
+// Caller must hold p->lock.
+void
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  p->state = RUNNABLE;
+  rq = &runq[pickcpu(p)];
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->n++;
+  release(&rq->lock);
+}
+
+// Take the first process on rq that may run on CPU id.
+// That is normally the head, unless rq belongs to another CPU.
+static struct proc*
+runqget(struct runq *rq, int id)
+{
+  struct proc *p, *prev;
+
+  acquire(&rq->lock);
+  prev = 0;
+  for(p = rq->head; p; p = p->rqnext){
+    if(p->affinity & (1 << id)){
+      if(prev)
+        prev->rqnext = p->rqnext;
+      else
+        rq->head = p->rqnext;
+      if(rq->tail == p)
+        rq->tail = prev;
+      p->rqnext = 0;
+      rq->n--;
+      break;
+    }
+    prev = p;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// CPU id has nothing to run: take a process from
+// the busiest other run queue.
+static struct proc*
+runqsteal(int id)
+{
+  int i, victim = -1;
+
+  for(i = 0; i < NCPU; i++){
+    if(i == id || runq[i].n == 0)
+      continue;
+    if(victim < 0 || runq[i].n > runq[victim].n)
+      victim = i;
+  }
+  if(victim < 0)
+    return 0;
+  return runqget(&runq[victim], id);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process from this CPU's run queue,
+//    or steal one from the busiest other queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,28 +635,40 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
   
   c->proc = 0;
+  c->online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = runqget(&runq[id], id)) == 0 && (p = runqsteal(id)) == 0){
+      // nothing to run; get a page ready for kalloc_zeroed().
+      kzeroidle();
+      continue;
     }
+
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->cpu = id;
+      c->proc = p;
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+#ifdef KSHARED
+      // get off p's page table, which may be freed
+      // as soon as p->lock is released.
+      kvmswitch();
+#endif
+    }
+    release(&p->lock);
   }
 }
 
@@ -504,7 +705,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -530,53 +731,88 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel process's first scheduling by scheduler()
+// will swtch to kprocstart.
+static void
+kprocstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kproc returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = chanq(chan);
+  struct proc **pp;
   
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
-
+  // Join chan's wait queue before releasing lk, so that
+  // a wakeup(chan) that follows a change to the condition
+  // will find p. Must acquire p->lock in order to
+  // change p->state and then call sched. Once we hold
+  // p->lock, we can be guaranteed that we won't miss
+  // any wakeup (wakeup locks p->lock), so it's okay
+  // to release lk.
+
+  acquire(&wq->lock);
+  p->chan = chan;
+  p->wqnext = wq->head;
+  wq->head = p;
   acquire(&p->lock);  //DOC: sleeplock1
+  release(&wq->lock);
   release(lk);
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
 
   sched();
 
-  // Tidy up.
+  // Tidy up: leave the wait queue.
+  release(&p->lock);
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      break;
+    }
+  }
   p->chan = 0;
+  p->wqnext = 0;
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
+// Processes leave the wait queue themselves,
+// once they run again.
 void
 wakeup(void *chan)
 {
+  struct waitq *wq = chanq(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = p->wqnext) {
+    if(p != myproc() && p->chan == chan){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING) {
+        setrunnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -593,7 +829,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -603,6 +839,34 @@ kill(int pid)
   return -1;
 }
 
+// Restrict the calling process to the CPUs whose bits
+// are set in mask. Returns -1 if mask includes no
+// running CPU.
+int
+setaffinity(int mask)
+{
+  struct proc *p = myproc();
+  int i, here;
+
+  for(i = 0; i < NCPU; i++)
+    if((mask & (1 << i)) && cpus[i].online)
+      break;
+  if(i == NCPU)
+    return -1;
+
+  acquire(&p->lock);
+  p->affinity = mask;
+  release(&p->lock);
+
+  // move to an allowed CPU.
+  push_off();
+  here = mask & (1 << cpuid());
+  pop_off();
+  if(!here)
+    yield();
+  return 0;
+}
+
 void
 setkilled(struct proc *p)
 {
@@ -24,6 +24,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int online;                 // Has this CPU entered scheduler()?
+  uint asidgen;               // ASID generation the TLB holds entries of
 };
 
 extern struct cpu cpus[NCPU];
@@ -33,7 +35,8 @@ extern struct cpu cpus[NCPU];
 // user page table. not specially mapped in the kernel page table.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
-// kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
+// kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap,
+// flushing the TLB around the switch only if kernel_flush is set.
 // usertrapret() and userret in trampoline.S set up
 // the trapframe's kernel_*, restore user registers from the
 // trapframe, switch to the user page table, and enter user space.
@@ -77,6 +80,31 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 kernel_flush;  // flush TLB on satp switch (no ASIDs)
+};
+
+// A loadable segment of the program a process is running.
+// exec() only records it; vmfault() reads it in a page at
+// a time as the process touches it.
+struct execseg {
+  uint64 va;      // where it starts; page-aligned
+  uint64 memsz;   // bytes of memory
+  uint64 filesz;  // bytes read from the file; the rest are zero
+  uint off;       // file offset of va
+  int perm;       // PTE_W, PTE_X
+};
+
+// A region of memory mapped by mmap(). Its pages are
+// faulted in by vmafault().
+struct vma {
+  uint64 addr;       // page-aligned start
+  uint64 len;        // bytes, a multiple of PGSIZE; 0 if unused
+  int prot;          // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;         // MAP_SHARED or MAP_PRIVATE, MAP_ANONYMOUS
+  struct file *f;    // the mapped file; 0 if anonymous
+  struct share *share; // the pages, if MAP_SHARED; see mmap.c
+  struct shm *shm;   // the attached segment, if from shmat()
+  uint off;          // file offset of addr
 };
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
@@ -87,10 +115,16 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU it last ran on
+  int affinity;                // Bit i set if it may run on CPU i
+  struct proc *rqnext;         // Next on the run queue (run queue lock)
+
+  // the lock of chan's wait queue must be held when using these:
+  void *chan;                  // If non-zero, sleeping on chan
+  struct proc *wqnext;         // Next on chan's wait queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -103,5 +137,13 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *execip;        // Program file, for demand paging
+  struct execseg seg[NEXECSEG]; // Its loadable segments
+  int nseg;
+  struct vma vma[NVMA];        // mmap()ed regions
   char name[16];               // Process name (debugging)
+  int asid;                    // Address-space ID tagging its TLB entries
+  uint asidgen;                // Generation of asid; 0 if it needs one
+  int tlbstale;                // Bit i set if CPU i's TLB may be stale
+  void (*kfn)(void);           // Body of a kernel process, else 0
 };
@@ -0,0 +1,242 @@
+// Shared-memory segments.
+//
+// A segment is a set of zeroed pages that any process can
+// attach with shmat(), which maps the very same pages into its
+// address space as a MAP_SHARED region (a struct vma with shm
+// set; see mmap.c), so processes exchange data through it
+// without the kernel copying anything. shmget() finds a segment
+// by a key that the processes agree on, or creates it; key 0
+// always creates a new one, to be shared across fork().
+//
+// Each attachment holds a reference to its segment, including
+// those fork() copies, as does the segment's id until shmrm().
+// The segment, and the reference it holds to each of its pages,
+// go away with the last of these.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "proc.h"
+#include "fcntl.h"
+
+#define SHMMAXPAGES (PGSIZE / sizeof(uint64))  // pages per segment
+
+struct shm {
+  int ref;        // attachments, plus one until removed; 0 if free
+  int key;
+  int removed;    // shmrm() was called
+  uint npages;
+  uint64 *pages;  // physical addresses; a page of its own
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Free a segment's pages.
+static void
+shmfree(uint64 *pages, uint npages)
+{
+  for(uint i = 0; i < npages; i++)
+    kfree((void*)pages[i]);
+  kfree(pages);
+}
+
+// Find the live segment with key. Caller holds shmtab.lock.
+static struct shm *
+shmlookup(int key)
+{
+  struct shm *s;
+
+  for(s = shmtab.shm; s < shmtab.shm + NSHM; s++)
+    if(s->ref > 0 && !s->removed && s->key == key)
+      return s;
+  return 0;
+}
+
+// Return the id of the segment with key, creating it with
+// size bytes if there is none. key 0 always creates one.
+// Returns -1 if an existing segment is smaller than size,
+// or if out of segments or memory.
+int
+shmget(int key, uint64 size)
+{
+  struct shm *s;
+  uint64 *pages;
+  uint npages, i;
+  int id;
+
+  if(size == 0 || size > SHMMAXPAGES * PGSIZE)
+    return -1;
+  npages = PGROUNDUP(size) / PGSIZE;
+
+  if(key != 0){
+    acquire(&shmtab.lock);
+    if((s = shmlookup(key)) != 0){
+      id = s->npages >= npages ? s - shmtab.shm : -1;
+      release(&shmtab.lock);
+      return id;
+    }
+    release(&shmtab.lock);
+  }
+
+  // zero the pages before taking the lock.
+  if((pages = kalloc()) == 0)
+    return -1;
+  for(i = 0; i < npages; i++){
+    if((pages[i] = (uint64)kalloc_zeroed()) == 0){
+      shmfree(pages, i);
+      return -1;
+    }
+  }
+
+  acquire(&shmtab.lock);
+  if(key != 0 && (s = shmlookup(key)) != 0){
+    // created while we were allocating.
+    id = s->npages >= npages ? s - shmtab.shm : -1;
+    release(&shmtab.lock);
+    shmfree(pages, npages);
+    return id;
+  }
+  for(s = shmtab.shm; s < shmtab.shm + NSHM; s++)
+    if(s->ref == 0)
+      break;
+  if(s == shmtab.shm + NSHM){
+    release(&shmtab.lock);
+    shmfree(pages, npages);
+    return -1;
+  }
+  s->ref = 1;
+  s->key = key;
+  s->removed = 0;
+  s->npages = npages;
+  s->pages = pages;
+  release(&shmtab.lock);
+  return s - shmtab.shm;
+}
+
+// Return the live segment with id, with a reference
+// for the caller, or 0.
+static struct shm *
+shmid(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  s = &shmtab.shm[id];
+  acquire(&shmtab.lock);
+  if(s->ref == 0 || s->removed){
+    release(&shmtab.lock);
+    return 0;
+  }
+  s->ref++;
+  release(&shmtab.lock);
+  return s;
+}
+
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop a reference to s, freeing it with the last one.
+void
+shmput(struct shm *s)
+{
+  uint64 *pages = 0;
+  uint npages = 0;
+
+  acquire(&shmtab.lock);
+  if(--s->ref == 0){
+    pages = s->pages;
+    npages = s->npages;
+    s->pages = 0;
+    s->npages = 0;
+  }
+  release(&shmtab.lock);
+  if(pages)
+    shmfree(pages, npages);
+}
+
+// Return the physical address of page i of s, or 0.
+uint64
+shmpage(struct shm *s, uint64 i)
+{
+  // an attachment's reference keeps pages from changing.
+  if(i >= s->npages)
+    return 0;
+  return s->pages[i];
+}
+
+// Attach segment id to the current process, mapping all of
+// its pages. Returns the address, or -1.
+uint64
+shmat(int id)
+{
+  struct proc *p = myproc();
+  struct shm *s;
+  struct vma *v;
+  uint64 va;
+
+  if((s = shmid(id)) == 0)
+    return -1;
+  if((v = vmaalloc((uint64)s->npages * PGSIZE)) == 0){
+    shmput(s);
+    return -1;
+  }
+  v->prot = PROT_READ | PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->shm = s;
+  for(va = v->addr; va < v->addr + v->len; va += PGSIZE){
+    if(vmafault(p, v, va, 1) == 0){
+      munmap(v->addr, v->len);
+      return -1;
+    }
+  }
+  return v->addr;
+}
+
+// Detach the segment attached at addr from the current process.
+int
+shmdt(uint64 addr)
+{
+  struct vma *v = vmafind(myproc(), addr);
+
+  if(v == 0 || v->shm == 0 || v->addr != addr)
+    return -1;
+  return munmap(v->addr, v->len);
+}
+
+// Remove segment id. Processes that have it attached keep
+// it until they detach; no one can attach it again.
+int
+shmrm(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtab.shm[id];
+  acquire(&shmtab.lock);
+  if(s->ref == 0 || s->removed){
+    release(&shmtab.lock);
+    return -1;
+  }
+  s->removed = 1;
+  release(&shmtab.lock);
+  shmput(s);
+  return 0;
+}
@@ -0,0 +1,167 @@
+// Object caches for small kernel objects, such as pipes
+// and open files, that would waste most of a page each.
+//
+// A cache carves pages from kalloc() into slabs of
+// equal-sized objects. A slab's header, at the start of
+// its page, holds a list of the slab's free objects, so
+// that kcache_free() finds it by rounding the object's
+// address down. A slab whose objects are all free goes
+// back to kalloc().
+//
+// Each CPU keeps a magazine of up to KMAG free objects per
+// cache, so most allocations and frees touch neither the
+// cache's lock nor kalloc(). An empty magazine is refilled,
+// and a full one half emptied, KMAG/2 objects at a time.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+
+struct slab {
+  struct slab *next;  // on the cache's partial list
+  struct slab *prev;
+  void *free;         // free objects, linked through their first word
+  int nfree;
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+void
+kcache_init(struct kcache *c, char *name, uint size)
+{
+  initlock(&c->lock, "kcache");
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  if(c->perslab < 1)
+    panic("kcache_init");
+  c->partial = 0;
+  c->nslab = 0;
+  for(int i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+}
+
+static void
+slab_unlink(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+slab_link(struct kcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Allocate and carve up a new slab page.
+// Caller must hold c->lock.
+static struct slab*
+slab_new(struct kcache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->free = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    obj = (char*)s + SLABHDR + i*c->size;
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  s->nfree = c->perslab;
+  slab_link(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Fill CPU id's empty magazine with up to KMAG/2 objects.
+// Called with interrupts off.
+static void
+mag_fill(struct kcache *c, int id)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(c->mag[id].n < KMAG/2){
+    if((s = c->partial) == 0 && (s = slab_new(c)) == 0)
+      break;
+    obj = s->free;
+    s->free = *(void**)obj;
+    if(--s->nfree == 0)
+      slab_unlink(c, s);
+    c->mag[id].obj[c->mag[id].n++] = obj;
+  }
+  release(&c->lock);
+}
+
+// Return KMAG/2 objects from CPU id's full magazine to
+// their slabs. Called with interrupts off.
+static void
+mag_drain(struct kcache *c, int id)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(c->mag[id].n > KMAG/2){
+    obj = c->mag[id].obj[--c->mag[id].n];
+    s = (struct slab*)PGROUNDDOWN((uint64)obj);
+    *(void**)obj = s->free;
+    s->free = obj;
+    if(s->nfree++ == 0)
+      slab_link(c, s);
+    if(s->nfree == c->perslab){
+      slab_unlink(c, s);
+      c->nslab--;
+      kfree((void*)s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate an object from cache c. Its contents are
+// whatever its last user left.
+// Returns 0 if memory is exhausted.
+void*
+kcache_alloc(struct kcache *c)
+{
+  void *obj = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == 0)
+    mag_fill(c, id);
+  if(c->mag[id].n > 0)
+    obj = c->mag[id].obj[--c->mag[id].n];
+  pop_off();
+  return obj;
+}
+
+// Free an object allocated from cache c.
+void
+kcache_free(struct kcache *c, void *obj)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == KMAG)
+    mag_drain(c, id);
+  c->mag[id].obj[c->mag[id].n++] = obj;
+  pop_off();
+}
@@ -0,0 +1,21 @@
+// Typed caches of small kernel objects (slab.c).
+
+#define KMAG 8  // objects in a CPU's magazine
+
+struct slab;
+
+struct kcache {
+  struct spinlock lock; // protects the slabs
+  char *name;           // Name of cache (debugging)
+  uint size;            // Object size, a multiple of 8
+  int perslab;          // Objects per slab page
+  struct slab *partial; // Slabs with free objects
+  int nslab;            // Slab pages allocated
+
+  // each CPU's magazine of free objects, used with
+  // interrupts off instead of a lock.
+  struct {
+    int n;
+    void *obj[KMAG];
+  } mag[NCPU];
+};
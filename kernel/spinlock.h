@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For performance statistics:
+  uint64 nacquire;   // Number of times acquired.
+  uint64 ncontend;   // Acquisitions that had to spin.
 };
 
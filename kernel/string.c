@@ -1,13 +1,37 @@
 #include "types.h"
+#include "riscv.h"
+
+// memset, memmove and the page routines move 8-byte words
+// where the addresses allow it, eight words per loop
+// iteration, and single bytes only at the unaligned ends.
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 *wdst, w;
+
+  // byte-wise until dst is aligned.
+  while(n > 0 && ((uint64)cdst & 7)){
+    *cdst++ = c;
+    n--;
   }
+
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (uint64 *) cdst;
+  for(; n >= 64; n -= 64, wdst += 8){
+    wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+    wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
+  }
+  for(; n >= 8; n -= 8)
+    *wdst++ = w;
+
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -39,17 +63,79 @@ memmove(void *dst, const void *src, uint n)
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // overlapping, with dst above src: copy backwards.
     s += n;
     d += n;
+    if((((uint64)s ^ (uint64)d) & 7) == 0){
+      while(n > 0 && ((uint64)d & 7)){
+        *--d = *--s;
+        n--;
+      }
+      for(; n >= 64; n -= 64){
+        s -= 64;
+        d -= 64;
+        const uint64 *ws = (const uint64 *) s;
+        uint64 *wd = (uint64 *) d;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= 8; n -= 8){
+        s -= 8;
+        d -= 8;
+        *(uint64 *)d = *(const uint64 *)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if((((uint64)s ^ (uint64)d) & 7) == 0){
+      while(n > 0 && ((uint64)d & 7)){
+        *d++ = *s++;
+        n--;
+      }
+      for(; n >= 64; n -= 64, s += 64, d += 64){
+        const uint64 *ws = (const uint64 *) s;
+        uint64 *wd = (uint64 *) d;
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= 8; n -= 8, s += 8, d += 8)
+        *(uint64 *)d = *(const uint64 *)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
 
+// Zero the page-aligned page at pa.
+void
+pgzero(void *pa)
+{
+  uint64 *p = (uint64 *) pa;
+  uint64 *end = p + PGSIZE/8;
+
+  for(; p < end; p += 8){
+    p[0] = 0; p[1] = 0; p[2] = 0; p[3] = 0;
+    p[4] = 0; p[5] = 0; p[6] = 0; p[7] = 0;
+  }
+}
+
+// Copy the page-aligned page at src to dst.
+void
+pgcopy(void *dst, const void *src)
+{
+  uint64 *d = (uint64 *) dst;
+  const uint64 *s = (const uint64 *) src;
+  uint64 *end = d + PGSIZE/8;
+
+  for(; d < end; d += 8, s += 8){
+    d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3];
+    d[4] = s[4]; d[5] = s[5]; d[6] = s[6]; d[7] = s[7];
+  }
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void*
 memcpy(void *dst, const void *src, uint n)
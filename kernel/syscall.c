@@ -101,6 +101,18 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_sysinfo(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_setreadahead(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_shmrm(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_copy_file_range(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +138,18 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_sysinfo] sys_sysinfo,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_setreadahead] sys_setreadahead,
+[SYS_fsync]   sys_fsync,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_shmrm]   sys_shmrm,
+[SYS_splice]  sys_splice,
+[SYS_copy_file_range] sys_copy_file_range,
 };
 
 void
@@ -20,3 +20,15 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_sysinfo 22
+#define SYS_setaffinity 23
+#define SYS_setreadahead 24
+#define SYS_fsync  25
+#define SYS_mmap   26
+#define SYS_munmap 27
+#define SYS_shmget 28
+#define SYS_shmat  29
+#define SYS_shmdt  30
+#define SYS_shmrm  31
+#define SYS_splice 32
+#define SYS_copy_file_range 33
@@ -119,6 +119,77 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until earlier changes to the file system, including
+// those made through fd, are on disk.
+uint64
+sys_fsync(void)
+{
+  if(argfd(0, 0, 0) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// Map a file, or anonymous memory with MAP_ANONYMOUS,
+// into the process. The address argument is ignored.
+uint64
+sys_mmap(void)
+{
+  uint64 len;
+  int prot, flags, off;
+  struct file *f = 0;
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+// Move up to n bytes from one fd to another without copying
+// them through user space. One fd must be a pipe and the other
+// a file. Returns the number of bytes moved, or -1.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// Copy up to n bytes from one file to another inside the
+// kernel, at and advancing the offsets of both fds.
+// Returns the number of bytes copied, or -1.
+uint64
+sys_copy_file_range(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filecopy(in, out, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -341,6 +412,13 @@ sys_open(void)
     return -1;
   }
 
+  // a running program can't be changed; see iexec().
+  if(ip->nexec > 0 && (omode & (O_WRONLY|O_RDWR|O_TRUNC))){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
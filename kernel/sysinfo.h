@@ -0,0 +1,17 @@
+// Kernel statistics, filled in by the sysinfo() system call.
+
+#define NKORDER 10  // page allocator block sizes: 4096 << 0..NKORDER-1
+
+struct sysinfo {
+  uint64 freemem;        // bytes of free physical memory
+  uint64 kmem_acquire;   // acquisitions of the kalloc locks
+  uint64 kmem_contend;   // ... that had to spin
+  uint64 kmem_steal;     // batches stolen from another CPU's free list
+  uint64 bcache_acquire; // acquisitions of the buffer cache locks
+  uint64 bcache_contend; // ... that had to spin
+  uint64 cpu;            // the CPU the caller is running on
+  uint64 ra_issued;      // blocks read ahead of a sequential reader
+  uint64 ra_hit;         // ... that were then read before eviction
+  uint64 ra_window;      // blocks read ahead; see setreadahead()
+  uint64 kmem_blocks[NKORDER]; // free blocks of 4096 << i bytes
+};
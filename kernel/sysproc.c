@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sysinfo.h"
 
 uint64
 sys_exit(void)
@@ -89,3 +90,85 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// restrict the calling process to the CPUs in
+// the bit mask in argument 0.
+uint64
+sys_setaffinity(void)
+{
+  int mask;
+
+  argint(0, &mask);
+  return setaffinity(mask);
+}
+
+// set how many blocks readi() reads ahead of a
+// sequential reader to argument 0, 0 to READAHEAD.
+uint64
+sys_setreadahead(void)
+{
+  int n;
+
+  argint(0, &n);
+  return bsetwindow(n);
+}
+
+// copy kernel statistics to the struct sysinfo
+// at the user address in argument 0.
+uint64
+sys_sysinfo(void)
+{
+  uint64 addr;
+  struct sysinfo info;
+
+  argaddr(0, &addr);
+  memset(&info, 0, sizeof(info));
+  kmemstats(&info);
+  bstats(&info);
+  push_off();
+  info.cpu = cpuid();
+  pop_off();
+  if(copyout(myproc()->pagetable, addr, (char *)&info, sizeof(info)) < 0)
+    return -1;
+  return 0;
+}
+
+// return the id of the shared-memory segment with key
+// argument 0, creating it with the size in argument 1.
+uint64
+sys_shmget(void)
+{
+  int key;
+  uint64 size;
+
+  argint(0, &key);
+  argaddr(1, &size);
+  return shmget(key, size);
+}
+
+uint64
+sys_shmat(void)
+{
+  int id;
+
+  argint(0, &id);
+  return shmat(id);
+}
+
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return shmdt(addr);
+}
+
+uint64
+sys_shmrm(void)
+{
+  int id;
+
+  argint(0, &id);
+  return shmrm(id);
+}
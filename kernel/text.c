@@ -0,0 +1,197 @@
+// Text page cache.
+//
+// Processes running the same program share the pages of its
+// read-only segments (text and rodata), instead of each reading
+// in a private copy. vmfault() gets such pages from textpage(),
+// and exec() maps whatever of a program is already cached before
+// the program starts, with uvmtext().
+//
+// The cache holds a reference to each page it keeps, so a page
+// stays cached after the last process using it exits, until its
+// entry is recycled, least recently used first. Entries are
+// hashed by (dev, inum, off). Each also records the inode's
+// generation (ip->gen), which changes whenever the file is
+// written or truncated; an entry of an older generation is never
+// used, and is recycled as soon as it is found. When memory runs
+// out, kalloc() calls textreclaim() to free the pages that only
+// the cache still uses.
+//
+// Since kalloc() may take text.lock, text.lock comes after any
+// lock held while calling kalloc(), and before the allocator's
+// own locks (tdrop() calls kfree()). Nothing here calls kalloc()
+// while holding text.lock.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NTEXTPAGE 256
+#define NTEXTHASH 31
+
+struct tpage {
+  uint dev;
+  uint inum;
+  uint gen;
+  uint off;            // file offset of the page's contents
+  uint n;              // bytes from the file; the rest are zero
+  uint64 pa;           // the page, or 0 if the entry is free
+  uint lastuse;
+  struct tpage *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct tpage page[NTEXTPAGE];
+  struct tpage *hash[NTEXTHASH];
+  uint clock;
+} text;
+
+static struct tpage **
+thash(uint dev, uint inum, uint off)
+{
+  return &text.hash[(dev + inum + off / PGSIZE) % NTEXTHASH];
+}
+
+void
+textinit(void)
+{
+  initlock(&text.lock, "text");
+}
+
+// Remove t from the cache, dropping its reference to the page.
+// Caller holds text.lock.
+static void
+tdrop(struct tpage *t)
+{
+  struct tpage **tp;
+
+  for(tp = thash(t->dev, t->inum, t->off); *tp != t; tp = &(*tp)->next)
+    ;
+  *tp = t->next;
+  kfree((void*)t->pa);
+  t->pa = 0;
+}
+
+// Find the entry for n bytes of an inode at off, of generation gen.
+// Recycles an entry of an older generation. Caller holds text.lock.
+static struct tpage *
+tfind(uint dev, uint inum, uint gen, uint off, uint n)
+{
+  struct tpage *t;
+
+  for(t = *thash(dev, inum, off); t != 0; t = t->next){
+    if(t->dev == dev && t->inum == inum && t->off == off){
+      if(t->gen == gen && t->n == n)
+        return t;
+      tdrop(t);
+      return 0;
+    }
+  }
+  return 0;
+}
+
+// Drop the cached pages that no process has mapped.
+// Returns how many were dropped.
+int
+textreclaim(void)
+{
+  struct tpage *t;
+  int n = 0;
+
+  acquire(&text.lock);
+  for(t = text.page; t < text.page + NTEXTPAGE; t++){
+    if(t->pa != 0 && krefcnt((void*)t->pa) == 1){
+      tdrop(t);
+      n++;
+    }
+  }
+  release(&text.lock);
+  return n;
+}
+
+// Return the cached page holding n bytes of ip from off,
+// with a reference for the caller, or 0 if it isn't cached.
+// ip must not be locked.
+uint64
+textlookup(struct inode *ip, uint off, uint n)
+{
+  struct tpage *t;
+  uint64 pa = 0;
+  uint gen;
+
+  // writei() and itrunc() change gen under the inode lock.
+  ilock(ip);
+  gen = ip->gen;
+  iunlock(ip);
+
+  acquire(&text.lock);
+  if((t = tfind(ip->dev, ip->inum, gen, off, n)) != 0){
+    t->lastuse = ++text.clock;
+    pa = t->pa;
+    kdup((void*)pa);
+  }
+  release(&text.lock);
+  return pa;
+}
+
+// Return a page holding n bytes of ip from off followed by
+// zeros, with a reference for the caller: the cached one, or
+// else one read from ip, which is then cached. Returns 0 if
+// out of memory or the read fails. ip must not be locked.
+uint64
+textpage(struct inode *ip, uint off, uint n)
+{
+  struct tpage *t, *victim;
+  char *mem;
+  uint gen;
+  uint64 pa;
+
+  if((pa = textlookup(ip, off, n)) != 0)
+    return pa;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  ilock(ip);
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  gen = ip->gen;
+  iunlock(ip);
+  memset(mem + n, 0, PGSIZE - n);
+
+  acquire(&text.lock);
+  // another process may have cached the page meanwhile;
+  // if so, just keep ours private.
+  if(tfind(ip->dev, ip->inum, gen, off, n) == 0){
+    victim = 0;
+    for(t = text.page; t < text.page + NTEXTPAGE; t++){
+      if(t->pa == 0){
+        victim = t;
+        break;
+      }
+      if(victim == 0 || t->lastuse < victim->lastuse)
+        victim = t;
+    }
+    if(victim->pa)
+      tdrop(victim);
+    victim->dev = ip->dev;
+    victim->inum = ip->inum;
+    victim->gen = gen;
+    victim->off = off;
+    victim->n = n;
+    victim->pa = (uint64)mem;
+    victim->lastuse = ++text.clock;
+    kdup(mem);
+    victim->next = *thash(ip->dev, ip->inum, off);
+    *thash(ip->dev, ip->inum, off) = victim;
+  }
+  release(&text.lock);
+  return (uint64)mem;
+}
@@ -10,6 +10,7 @@ struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
+extern char ucopyfail[], ucopyend[];  // ucopy.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -65,6 +66,18 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault on a lazily allocated, copy-on-write, or not
+    // yet loaded page. vmfault() may read from the program
+    // file, so take interrupts meanwhile.
+    uint64 scause = r_scause();
+    uint64 stval = r_stval();
+    intr_on();
+    if(vmfault(p->pagetable, stval, scause == 15) == 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      setkilled(p);
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -119,14 +132,28 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and whether it must flush the TLB when switching.
+#ifdef KSHARED
+  // p's page table maps the kernel too, so switch to it
+  // here if need be; zeros tell userret and uservec
+  // to leave satp alone.
+  uvmswitch(p);
+  p->trapframe->kernel_satp = 0;
+  p->trapframe->kernel_flush = 0;
+  uint64 satp = 0;
+  int flush = 0;
+#else
+  int flush;
+  uint64 satp = uvmsatp(p, &flush);
+  p->trapframe->kernel_flush = flush;
+#endif
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, flush);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -144,7 +171,12 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)ucopy && sepc < (uint64)ucopyend){
+    // a page fault on a user address in copyin() or copyout().
+    if(ucopyfault(r_stval(), scause == 15) == 0)
+      sepc = (uint64)ucopyfail;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
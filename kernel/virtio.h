@@ -47,7 +47,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
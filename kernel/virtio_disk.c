@@ -46,7 +46,9 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[MAXIOBLOCKS];  // the request's buffers
+    int n;                       // how many
+    int write;                   // or a read?
     char status;
   } info[NUM];
 
@@ -178,7 +180,6 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
 }
 
 // free a chain of descriptors.
@@ -194,14 +195,14 @@ free_chain(int i)
     else
       break;
   }
+  wakeup(&disk.free[0]);
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +213,41 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// Start a read or write of the n buffers in b[], which
+// must hold consecutive blocks, as a single request, and
+// return without waiting for it to finish. The caller must
+// hold each b[i]->lock (or otherwise own it) until the
+// request completes; virtio_disk_intr() clears b[i]->disk
+// when it does. Many requests may be in flight at once.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_submitv(struct buf **b, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = b[0]->blockno * (BSIZE / 512);
+  int idx[MAXIOBLOCKS+2];
+
+  if(n < 1 || n > MAXIOBLOCKS)
+    panic("virtio_disk_submitv");
+  for(int i = 1; i < n; i++)
+    if(b[i]->dev != b[0]->dev || b[i]->blockno != b[0]->blockno + i)
+      panic("virtio_disk_submitv: not consecutive");
 
   acquire(&disk.vdisk_lock);
 
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // the spec's Section 5.2 says that block operations use
+  // a descriptor for type/reserved/sector, then the data
+  // descriptors, then one for a 1-byte status result.
+  // the data may be split over a chain of descriptors,
+  // here one per buffer.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n+2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +264,31 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 0; i < n; i++){
+    int d = idx[i+1];
+    disk.desc[d].addr = (uint64) b[i]->data;
+    disk.desc[d].len = BSIZE;
+    if(write)
+      disk.desc[d].flags = 0; // device reads b->data
+    else
+      disk.desc[d].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[d].flags |= VRING_DESC_F_NEXT;
+    disk.desc[d].next = idx[i+2];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
+
+  // record the struct bufs for virtio_disk_intr().
+  for(int i = 0; i < n; i++){
+    b[i]->disk = 1;
+    disk.info[idx[0]].b[i] = b[i];
+  }
+  disk.info[idx[0]].n = n;
+  disk.info[idx[0]].write = write;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -280,17 +302,35 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  release(&disk.vdisk_lock);
+}
+
+// Start a read or write of b, without waiting.
+void
+virtio_disk_submit(struct buf *b, int write)
+{
+  virtio_disk_submitv(&b, 1, write);
+}
+
+// Wait for virtio_disk_intr() to say that the
+// request for b has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -316,12 +356,24 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    for(int i = 0; i < disk.info[id].n; i++){
+      struct buf *b = disk.info[id].b[i];
+      disk.info[id].b[i] = 0;
+      // a buffer read ahead may have no one waiting for it,
+      // so mark it valid here.
+      if(!disk.info[id].write)
+        b->valid = 1;
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    }
+    disk.info[id].n = 0;
+    free_chain(id);
 
     disk.used_idx += 1;
   }
 
   release(&disk.vdisk_lock);
+
+  // read-ahead buffers are free once the disk is done.
+  bavail();
 }
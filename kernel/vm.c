@@ -4,7 +4,10 @@
 #include "elf.h"
 #include "riscv.h"
 #include "defs.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "fs.h"
+#include "fcntl.h"
 
 /*
  * the kernel's page table.
@@ -15,14 +18,32 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+static uint64 fault(pagetable_t, uint64, int, int);
+
+// Address-space IDs tag TLB entries with the page table they
+// came from, so that switching satp between the kernel and a
+// process needn't flush the TLB. The kernel page table uses
+// ASID 0; processes are handed 1..max in turn. When they run
+// out a new generation starts: every process gets a fresh ASID
+// the next time it returns to user space, and each CPU flushes
+// its whole TLB before first using an ASID of the new generation,
+// so an ASID is never shared by two live address spaces in one
+// TLB. exec() and fork()'s child start without an ASID.
+struct {
+  struct spinlock lock;
+  uint max;    // largest ASID the hardware supports, or 0 if none
+  uint next;   // next ASID to hand out
+  uint gen;    // current generation, from 1
+} asid;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -30,13 +51,15 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
-  // PLIC
+  // PLIC, as two megapages.
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // past the first megapage boundary after etext, this is
+  // all megapages.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -70,6 +93,236 @@ kvminithart()
   sfence_vma();
 }
 
+// Find out how many ASIDs the hardware supports, by writing
+// ones to satp's ASID field and seeing which bits stick.
+// Called once, after kvminithart().
+void
+asidinit(void)
+{
+  initlock(&asid.lock, "asid");
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID_MASK);
+  asid.max = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+  w_satp(MAKE_SATP(kernel_pagetable));
+  sfence_vma();
+  asid.next = 1;
+  asid.gen = 1;
+}
+
+// Return the satp value with which p should run in user space,
+// after flushing this CPU's TLB of anything stale for p. Sets
+// *flush if there are no ASIDs, in which case trampoline.S must
+// flush the TLB whenever it switches page tables.
+// Called by usertrapret() with interrupts off.
+uint64
+uvmsatp(struct proc *p, int *flush)
+{
+  struct cpu *c = mycpu();
+  int bit = 1 << cpuid();
+
+  if(asid.max == 0){
+    *flush = 1;
+    return MAKE_SATP(p->pagetable);
+  }
+  *flush = 0;
+
+  if(p->asidgen != __atomic_load_n(&asid.gen, __ATOMIC_ACQUIRE)){
+    acquire(&asid.lock);
+    if(asid.next > asid.max){
+      asid.gen++;
+      asid.next = 1;
+    }
+    p->asid = asid.next++;
+    p->asidgen = asid.gen;
+    release(&asid.lock);
+    p->tlbstale = 0;
+  }
+
+  if(c->asidgen != p->asidgen){
+    // the TLB may hold entries of an older generation
+    // with any ASID, including p's.
+    __sync_fetch_and_and(&p->tlbstale, ~bit);
+    sfence_vma();
+    c->asidgen = p->asidgen;
+  } else if(p->tlbstale & bit){
+    __sync_fetch_and_and(&p->tlbstale, ~bit);
+    sfence_vma_asid(p->asid);
+  }
+
+  return MAKE_SATP_ASID(p->pagetable, p->asid);
+}
+
+// Note that existing mappings in pagetable were removed or
+// changed. If it belongs to the current process, any CPU's
+// TLB may hold stale entries tagged with its ASID, which
+// uvmsatp() flushes before the process next runs there.
+static void
+uvmstale(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p != 0 && p->pagetable == pagetable)
+    __sync_fetch_and_or(&p->tlbstale, ~0);
+#ifdef KSHARED
+  // the kernel may itself be running on pagetable,
+  // and go on to use user addresses through it.
+  if(SATP2PA(r_satp()) == (uint64)pagetable)
+    sfence_vma();
+#endif
+}
+
+#ifdef KSHARED
+// With KSHARED, each user page table maps the kernel as well,
+// without PTE_U, so that traps and copyin()/copyout() can stay
+// on the process's page table. The kernel page table never
+// changes after boot, so a user page table can point at its
+// page-table pages wherever they cover no user address (below
+// USERTOP, or TRAPFRAME and up); where they do, the user page
+// table gets its own page-table pages holding copies of the
+// kernel's PTEs.
+
+// does the level-level PTE for va cover any user address?
+static int
+useroverlap(uint64 va, int level)
+{
+  return va < USERTOP || va + (1L << PXSHIFT(level)) > TRAPFRAME;
+}
+
+// map what kernel page-table page kpt maps, for va and up,
+// into user page-table page upt. Returns 0, or -1 if out
+// of memory.
+static int
+kvmshare(pagetable_t upt, pagetable_t kpt, uint64 va, int level)
+{
+  pagetable_t pt;
+
+  for(int i = 0; i < 512; i++){
+    pte_t kpte = kpt[i];
+    uint64 a = va + ((uint64)i << PXSHIFT(level));
+
+    if((kpte & PTE_V) == 0)
+      continue;
+    if(!useroverlap(a, level)){
+      upt[i] = kpte;
+    } else if(level > 0 && (kpte & (PTE_R|PTE_W|PTE_X)) == 0){
+      if((upt[i] & PTE_V) == 0){
+        if((pt = (pagetable_t)kalloc_zeroed()) == 0)
+          return -1;
+        upt[i] = PA2PTE(pt) | PTE_V;
+      }
+      if(kvmshare((pagetable_t)PTE2PA(upt[i]), (pagetable_t)PTE2PA(kpte),
+                  a, level-1) != 0)
+        return -1;
+    }
+    // else a kernel page at a user address: the trampoline,
+    // which the user page table maps itself.
+  }
+  return 0;
+}
+
+// undo kvmshare(), leaving only upt's own mappings.
+static void
+kvmunshare(pagetable_t upt, pagetable_t kpt, uint64 va, int level)
+{
+  for(int i = 0; i < 512; i++){
+    pte_t kpte = kpt[i];
+    uint64 a = va + ((uint64)i << PXSHIFT(level));
+
+    if((kpte & PTE_V) == 0 || (upt[i] & PTE_V) == 0)
+      continue;
+    if(!useroverlap(a, level)){
+      upt[i] = 0;
+    } else if(level > 0 && (kpte & (PTE_R|PTE_W|PTE_X)) == 0){
+      kvmunshare((pagetable_t)PTE2PA(upt[i]), (pagetable_t)PTE2PA(kpte),
+                 a, level-1);
+    }
+  }
+}
+
+// Map the kernel into a new user page table.
+// Returns 0, or -1 if out of memory, in which case
+// the caller must still call uvmkunmap().
+int
+uvmkmap(pagetable_t pagetable)
+{
+  return kvmshare(pagetable, kernel_pagetable, 0, 2);
+}
+
+// Remove the kernel's mappings from a user page table
+// that is about to be freed.
+void
+uvmkunmap(pagetable_t pagetable)
+{
+  // don't free the page table this CPU is running on.
+  if(SATP2PA(r_satp()) == (uint64)pagetable)
+    kvmswitch();
+  kvmunshare(pagetable, kernel_pagetable, 0, 2);
+}
+
+// Switch this CPU to the kernel page table, so that the
+// page table it was running on may be freed.
+void
+kvmswitch(void)
+{
+  uint64 satp = MAKE_SATP(kernel_pagetable);
+
+  if(r_satp() == satp)
+    return;
+  if(asid.max == 0)
+    sfence_vma();
+  w_satp(satp);
+  if(asid.max == 0)
+    sfence_vma();
+}
+
+// Switch this CPU to p's page table.
+void
+uvmswitch(struct proc *p)
+{
+  uint64 satp;
+  int flush;
+
+  push_off();
+  satp = uvmsatp(p, &flush);
+  if(r_satp() != satp){
+    if(flush)
+      sfence_vma();
+    w_satp(satp);
+    if(flush)
+      sfence_vma();
+  }
+  pop_off();
+}
+
+// Called by kerneltrap() for a page fault at user address va
+// in ucopy(). Returns 1 if ucopy() may retry the access, 0 if
+// va is not valid for it.
+// This runs with interrupts off, maybe holding spinlocks, so
+// it can't read a page from a file; copyin() and copyout()
+// fault in such pages with vmprefault() before ucopy(), and
+// leave only faults that need no I/O, such as zero-fill and
+// copy-on-write, to this.
+int
+ucopyfault(uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  if(p == 0 || va >= USERTOP)
+    return 0;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+     (write && (*pte & PTE_W) == 0)){
+    if(fault(p->pagetable, va, write, 0) == 0)
+      return 0;
+  }
+  // the CPU may have switched to the kernel page table
+  // since ucopy() started, or cached the missing PTE.
+  uvmswitch(p);
+  sfence_vma();
+  return 1;
+}
+#endif
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -84,26 +337,48 @@ kvminithart()
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
+}
+
+// Like walk(), but return the PTE at the given level:
+// 0 for a 4096-byte page, 1 for a megapage. If a
+// megapage already maps va, return its PTE instead.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int leaf, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > leaf; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) && (*pte & (PTE_R|PTE_W|PTE_X)))
+      return pte;  // a megapage
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(leaf, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// Return the physical address of the page that holds va,
+// given va's leaf PTE, which may map a megapage.
+static uint64
+pte2pa(pte_t pte, uint64 va)
+{
+  uint64 pa = PTE2PA(pte);
+
+  if(pte & PTE_MEGA)
+    pa += PGROUNDDOWN(va) & (MEGAPGSIZE-1);
+  return pa;
+}
+
+// Look up a virtual address, return the physical address
+// of its page, or 0 if not mapped.
 // Can only be used to look up user pages.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
@@ -121,7 +396,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = pte2pa(*pte, va);
   return pa;
 }
 
@@ -137,13 +412,16 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Kernel (non-PTE_U) mappings use a megapage
+// wherever va and pa are megapage-aligned and the range covers
+// the whole megapage. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, sz;
   pte_t *pte;
+  int leaf;
 
   if(size == 0)
     panic("mappages: size");
@@ -151,21 +429,83 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    leaf = 0;
+    if((perm & PTE_U) == 0 && ((a | pa) & (MEGAPGSIZE-1)) == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE)
+      leaf = 1;
+    if((pte = walklevel(pagetable, a, leaf, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(leaf)
+      *pte |= PTE_MEGA;
+    sz = leaf ? MEGAPGSIZE : PGSIZE;
+    if(last - a < sz)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += sz;
+    pa += sz;
   }
   return 0;
 }
 
+// Replace the user megapage mapping whose leaf PTE is *pte
+// with a page-table page of PTEs for each of its pages, so
+// that they can be unmapped, freed or shared one at a time.
+// Returns 0, or -1 if out of memory.
+static int
+uvmsplit(pte_t *pte)
+{
+  pagetable_t pt;
+  uint64 pa = PTE2PA(*pte);
+  uint64 flags = PTE_FLAGS(*pte) & ~PTE_MEGA;
+
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(pt) | PTE_V;
+  return 0;
+}
+
+// Return the PTE for the user page at va, as walk() does,
+// but first split a megapage that maps it.
+static pte_t *
+walksplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte = walk(pagetable, va, 0);
+
+  if(pte != 0 && (*pte & PTE_V) && (*pte & PTE_MEGA)){
+    if(uvmsplit(pte) != 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  return pte;
+}
+
+// Map a zeroed megapage at the megapage-aligned va, if none
+// of the megapage's range is mapped yet and a free megapage
+// is available. Returns its physical address, or 0.
+static uint64
+uvmmega(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+  char *mem;
+
+  if((pte = walklevel(pagetable, va, 1, 1)) == 0 || (*pte & PTE_V))
+    return 0;
+  if((mem = kalloc_pages(MEGAPGORDER)) == 0)
+    return 0;
+  memset(mem, 0, MEGAPGSIZE);
+  *pte = PA2PTE(mem) | perm | PTE_MEGA | PTE_V;
+  return (uint64)mem;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in (see
+// vmfault()) are skipped. A megapage that lies entirely
+// in the range is removed whole; one that doesn't is
+// split first.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -178,9 +518,20 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if(*pte & PTE_MEGA){
+      if((a % MEGAPGSIZE) == 0 && a + MEGAPGSIZE <= va + npages*PGSIZE){
+        if(do_free)
+          kfree_pages((void*)PTE2PA(*pte), MEGAPGORDER);
+        *pte = 0;
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if((pte = walksplit(pagetable, a)) == 0)
+        panic("uvmunmap: split");
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -189,6 +540,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     }
     *pte = 0;
   }
+  uvmstale(pagetable);
 }
 
 // create an empty user page table.
@@ -197,10 +549,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,8 +565,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -230,15 +580,21 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > USERTOP)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if((a % MEGAPGSIZE) == 0 && a + MEGAPGSIZE <= newsz &&
+       uvmmega(pagetable, a, PTE_R|PTE_U|xperm) != 0){
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -296,42 +652,256 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, make a child's
+// page table share its physical memory. Writable pages
+// become read-only and copy-on-write in both page tables;
+// vmfault() gives a process its own copy of such a page
+// the first time it stores to it. The parent's megapages
+// are split, since pages are shared one at a time.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// Do what uvmcopy() does for the pages from va up to end,
+// both page-aligned, except that if share is set writable
+// pages stay writable, and so shared, in both page tables.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 va, uint64 end, int share)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+  // the parent's writable pages are about to become read-only.
+  if(!share)
+    uvmstale(old);
+
+  for(i = va; i < end; i += PGSIZE){
+    if((pte = walk(old, i, 0)) != 0 && (*pte & PTE_MEGA) &&
+       (pte = walksplit(old, i)) == 0)
+      goto err;
+    if(pte == 0)
+      continue;  // not yet touched by a lazy sbrk()
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if((*pte & PTE_W) && !share)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kdup((void*)pa);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
+// Return the segment of p's program that overlaps
+// [va, va+len), or 0.
+static struct execseg *
+findseg(struct proc *p, uint64 va, uint64 len)
+{
+  struct execseg *s;
+
+  for(s = p->seg; s < p->seg + p->nseg; s++)
+    if(va < s->va + s->memsz && s->va < va + len)
+      return s;
+  return 0;
+}
+
+// How many bytes of the page at va of segment s come
+// from the program file?
+static uint
+segbytes(struct execseg *s, uint64 va)
+{
+  if(va >= s->va + s->filesz)
+    return 0;
+  if(s->va + s->filesz - va > PGSIZE)
+    return PGSIZE;
+  return s->va + s->filesz - va;
+}
+
+// Map the page at va of p's program segment s, reading
+// the part of it that the segment's file holds and
+// zeroing the rest. Pages of read-only segments come
+// from the text cache, shared with other processes.
+// Returns its physical address, or 0.
+static uint64
+vmload(pagetable_t pagetable, struct proc *p, struct execseg *s, uint64 va)
+{
+  char *mem;
+  uint off = s->off + (va - s->va);
+  uint n = segbytes(s, va);
+
+  if((s->perm & PTE_W) == 0){
+    if((mem = (char*)textpage(p->execip, off, n)) == 0)
+      return 0;
+  } else {
+    if((mem = kalloc()) == 0)
+      return 0;
+    if(n > 0){
+      ilock(p->execip);
+      if(readi(p->execip, 0, (uint64)mem, off, n) != n){
+        iunlock(p->execip);
+        kfree(mem);
+        return 0;
+      }
+      iunlock(p->execip);
+    }
+    memset(mem + n, 0, PGSIZE - n);
+  }
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_U|s->perm) != 0){
+    kfree(mem);
+    return 0;
+  }
+  return (uint64)mem;
+}
+
+// Map into a new process's page table those pages of the
+// read-only program segment s, from ip, that the text
+// cache already holds, sparing the process the faults.
+void
+uvmtext(pagetable_t pagetable, struct inode *ip, struct execseg *s)
+{
+  uint64 va, pa;
+
+  for(va = s->va; va < s->va + s->memsz; va += PGSIZE){
+    if((pa = textlookup(ip, s->off + (va - s->va), segbytes(s, va))) == 0)
+      continue;
+    if(mappages(pagetable, va, PGSIZE, pa, PTE_R|PTE_U|s->perm) != 0){
+      kfree((void*)pa);
+      return;
+    }
+  }
+}
+
+// Handle a user page fault at virtual address va.
+// Pages of mmap()ed regions are left to vmafault(), and
+// the first store to a page of a writable shared file
+// mapping marks it dirty, for write-back by munmap().
+// exec() doesn't load the program, so a page of one of
+// its segments is read in (or, for bss, zeroed) here.
+// sbrk() only raises p->sz, so any other page below p->sz
+// that isn't mapped yet is allocated and zeroed here, with
+// the whole megapage around it if that lies below p->sz
+// and is still untouched.
+// A store to a copy-on-write page gets the process a
+// private, writable copy of the page; if no other page
+// table still shares the page, it is just made writable.
+// Returns the physical address of the page, or 0 if the
+// fault is a genuine error or memory is exhausted.
+uint64
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  return fault(pagetable, va, write, 1);
+}
+
+// vmfault(), except that if io is 0 a page that would have
+// to be read from a file isn't, and 0 is returned.
+static uint64
+fault(pagetable_t pagetable, uint64 va, int write, int io)
+{
+  pte_t *pte;
+  uint64 pa, mva;
+  uint flags;
+  char *mem;
+  struct proc *p = myproc();
+  struct execseg *s;
+  struct vma *v;
+
+  if(va >= MAXVA)
+    return 0;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(p == 0 || pagetable != p->pagetable)
+      return 0;
+    if((v = vmafind(p, va)) != 0){
+      if(v->f && !io)
+        return 0;
+      return vmafault(p, v, va, write);
+    }
+    if(va >= p->sz)
+      return 0;
+    if((s = findseg(p, va, PGSIZE)) != 0)
+      return io ? vmload(pagetable, p, s, va) : 0;
+    // demand-zero page from a lazy sbrk().
+    mva = va - va % MEGAPGSIZE;
+    if(mva + MEGAPGSIZE <= p->sz && findseg(p, mva, MEGAPGSIZE) == 0 &&
+       (pa = uvmmega(pagetable, mva, PTE_R|PTE_W|PTE_U)) != 0)
+      return pa + (va - mva);
+    if((mem = kalloc_zeroed()) == 0)
+      return 0;
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+      kfree(mem);
+      return 0;
+    }
+    return (uint64)mem;
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  if(write && (*pte & (PTE_W|PTE_COW)) == 0 && p != 0 &&
+     pagetable == p->pagetable && (v = vmafind(p, va)) != 0 &&
+     (v->prot & PROT_WRITE)){
+    *pte |= PTE_W | PTE_D;
+    uvmstale(pagetable);
+    return PTE2PA(*pte);
+  }
+  if(!write || (*pte & PTE_COW) == 0)
+    return 0;
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  uvmstale(pagetable);
+  if(krefcnt((void*)pa) == 1){
+    // the other sharers have already taken copies.
+    *pte = PA2PTE(pa) | flags;
+    return pa;
+  }
+  if((mem = kalloc()) == 0)
+    return 0;
+  pgcopy(mem, (char*)pa);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return (uint64)mem;
+}
+
+// Fault in whatever pages of [va, va+len) in the current
+// process's page table aren't mapped yet. copyin() and
+// copyout() may have to read a page of the program file
+// or of an mmap()ed file, which they can't while the
+// caller holds a spinlock or an inode lock (the file may
+// be the one locked), so such callers use this first, on
+// just the span they are about to copy; lazily allocated
+// pages that nothing is copied to stay unallocated.
+// Returns 0, or -1 if a page can't be faulted in, in which
+// case the caller should stop short of the span.
+int
+vmprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  struct proc *p = myproc();
+  uint64 a;
+  pte_t *pte;
+
+  if(p == 0 || pagetable != p->pagetable || len == 0)
+    return 0;
+  if(va >= USERTOP || len > USERTOP - va)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if((pte == 0 || (*pte & PTE_V) == 0) && vmfault(pagetable, a, write) == 0)
+      return -1;
+  }
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -339,10 +909,11 @@ uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
-  pte = walk(pagetable, va, 0);
+  pte = walksplit(pagetable, va);
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  uvmstale(pagetable);
 }
 
 // Copy from kernel to user.
@@ -352,12 +923,34 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+
+#ifdef KSHARED
+  struct proc *p = myproc();
+  if(p != 0 && pagetable == p->pagetable){
+    if(dstva >= USERTOP || len > USERTOP - dstva)
+      return -1;
+    // ucopyfault() can't read pages in from files.
+    if(vmprefault(pagetable, dstva, len, 1) < 0)
+      return -1;
+    uvmswitch(p);
+    return ucopy((void*)dstva, src, len);
+  }
+#endif
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
       return -1;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W)){
+      // fault in a lazily allocated page, break copy-on-write
+      // sharing, or refuse to write a read-only page.
+      if((pa0 = vmfault(pagetable, va0, 1)) == 0)
+        return -1;
+    } else {
+      pa0 = pte2pa(*pte, va0);
+    }
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -378,10 +971,23 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+#ifdef KSHARED
+  struct proc *p = myproc();
+  if(p != 0 && pagetable == p->pagetable){
+    if(srcva >= USERTOP || len > USERTOP - srcva)
+      return -1;
+    // ucopyfault() can't read pages in from files.
+    if(vmprefault(pagetable, srcva, len, 0) < 0)
+      return -1;
+    uvmswitch(p);
+    return ucopy(dst, (void*)srcva, len);
+  }
+#endif
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -408,7 +1014,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
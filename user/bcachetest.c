@@ -0,0 +1,96 @@
+// Several processes create, write and re-read their own
+// files at the same time, a stressfs-style workload.
+// Reports throughput and buffer cache lock statistics.
+//
+// usage: bcachetest [nproc]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NBLOCK 8
+#define ROUNDS 50
+
+char data[BSIZE];
+
+void
+worker(int id)
+{
+  char path[] = "bcache0";
+  int fd;
+
+  path[6] = '0' + id;
+  memset(data, 'a' + id, sizeof(data));
+  unlink(path);
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0){
+    printf("bcachetest: open %s failed\n", path);
+    exit(1);
+  }
+  for(int i = 0; i < NBLOCK; i++){
+    if(write(fd, data, sizeof(data)) != sizeof(data)){
+      printf("bcachetest: write %s failed\n", path);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  for(int r = 0; r < ROUNDS; r++){
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf("bcachetest: open %s failed\n", path);
+      exit(1);
+    }
+    for(int i = 0; i < NBLOCK; i++){
+      if(read(fd, data, sizeof(data)) != sizeof(data) || data[0] != 'a' + id){
+        printf("bcachetest: read %s failed\n", path);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  unlink(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sysinfo s0, s1;
+  int nproc = 4, xstatus, failed = 0;
+  int t0, t1;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > 10){
+    fprintf(2, "usage: bcachetest [nproc (1-10)]\n");
+    exit(1);
+  }
+
+  sysinfo(&s0);
+  t0 = uptime();
+  for(int i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("bcachetest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      worker(i);
+      exit(0);
+    }
+  }
+  for(int i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      failed = 1;
+  }
+  t1 = uptime();
+  sysinfo(&s1);
+
+  printf("bcachetest: %d procs, %d block reads in %d ticks\n",
+         nproc, nproc*ROUNDS*NBLOCK, t1 - t0);
+  printf("bcache: %d acquires, %d contended\n",
+         (int)(s1.bcache_acquire - s0.bcache_acquire),
+         (int)(s1.bcache_contend - s0.bcache_contend));
+  exit(failed);
+}
@@ -0,0 +1,33 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int fd0, fd1, n;
+
+  if(argc != 3){
+    fprintf(2, "Usage: cp from to\n");
+    exit(1);
+  }
+  if((fd0 = open(argv[1], O_RDONLY)) < 0){
+    fprintf(2, "cp: cannot open %s\n", argv[1]);
+    exit(1);
+  }
+  if((fd1 = open(argv[2], O_CREATE | O_WRONLY | O_TRUNC)) < 0){
+    fprintf(2, "cp: cannot create %s\n", argv[2]);
+    exit(1);
+  }
+  // the kernel copies the blocks without passing them through us.
+  while((n = copy_file_range(fd0, fd1, 64*1024)) > 0)
+    ;
+  if(n < 0){
+    fprintf(2, "cp: copy %s to %s failed\n", argv[1], argv[2]);
+    exit(1);
+  }
+  close(fd0);
+  close(fd1);
+  exit(0);
+}
@@ -0,0 +1,80 @@
+// Measure small-file create throughput, in the style of
+// stressfs: several processes each create, write and close
+// many small files, then remove them. A final fsync()
+// makes sure the work has reached the disk before the
+// clock stops.
+//
+// usage: createbench [nproc]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NFILE 50
+
+char data[512];
+
+void
+creates(int id)
+{
+  char path[] = "cb00";
+  int fd;
+
+  path[2] = 'a' + id;
+  for(int i = 0; i < NFILE; i++){
+    path[3] = '0' + i % 64;
+    if((fd = open(path, O_CREATE | O_WRONLY)) < 0){
+      printf("createbench: create %s failed\n", path);
+      exit(1);
+    }
+    if(write(fd, data, sizeof(data)) != sizeof(data)){
+      printf("createbench: write %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+    if(unlink(path) < 0){
+      printf("createbench: unlink %s failed\n", path);
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 4, t0, t1, xstatus, failed = 0;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > 26){
+    fprintf(2, "usage: createbench [nproc (1-26)]\n");
+    exit(1);
+  }
+  memset(data, 'c', sizeof(data));
+
+  t0 = uptime();
+  for(int i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("createbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      creates(i);
+  }
+  for(int i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      failed = 1;
+  }
+  if(fsync(1) < 0){
+    printf("createbench: fsync failed\n");
+    failed = 1;
+  }
+  t1 = uptime();
+
+  printf("createbench: %d procs, %d files in %d ticks\n",
+         nproc, nproc*NFILE, t1 - t0);
+  exit(failed);
+}
@@ -0,0 +1,44 @@
+// Time exec() of a large program that touches little of
+// itself: this program, which carries a big initialized
+// array, re-executed with an argument that makes it exit
+// at once.
+//
+// usage: execbench
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NEXEC 100
+
+// initialized, so that it takes up room in the program file.
+char big[64*1024] = { 1 };
+
+int
+main(int argc, char *argv[])
+{
+  char *args[] = { "execbench", "child", 0 };
+  int t0, xstatus;
+
+  if(argc > 1)
+    exit(0);
+
+  t0 = uptime();
+  for(int i = 0; i < NEXEC; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("execbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      printf("execbench: exec failed\n");
+      exit(1);
+    }
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  printf("execbench: %d execs of a %d KB program: %d ticks\n",
+         NEXEC, (int)sizeof(big) / 1024, uptime() - t0);
+  exit(0);
+}
@@ -0,0 +1,145 @@
+// Stress the physical page allocator from several processes
+// at once, each pinned to a CPU, and report throughput overall
+// and per CPU, kalloc lock statistics and how fragmented free
+// memory is afterwards. Each process grows and shrinks its heap,
+// touching every page, and forks children that break
+// copy-on-write pages, so page tables are allocated and freed too.
+//
+// usage: kalloctest [nproc]
+//
+// nproc defaults to the number of CPUs. Run it with different
+// numbers of harts (make CPUS=n qemu) to see how kalloc() scales.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define ROUNDS 200
+#define NPAGES 64
+#define NFORK 20     // forks per process
+#define FORKPAGES 8  // pages each forked child writes
+
+// allocate, touch and free NPAGES pages ROUNDS times,
+// and fork children that copy some of them on write.
+void
+churn(int round0)
+{
+  char *a, *p;
+  int pid;
+
+  for(int i = 0; i < ROUNDS; i++){
+    a = sbrk(NPAGES*PGSIZE);
+    if(a == (char*)0xffffffffffffffffL){
+      printf("kalloctest: sbrk failed\n");
+      exit(1);
+    }
+    for(p = a; p < a + NPAGES*PGSIZE; p += PGSIZE)
+      *p = i;
+    if(i % (ROUNDS / NFORK) == round0 % (ROUNDS / NFORK)){
+      if((pid = fork()) < 0){
+        printf("kalloctest: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        for(p = a; p < a + FORKPAGES*PGSIZE; p += PGSIZE)
+          *p = -i;
+        exit(0);
+      }
+      wait(0);
+    }
+    sbrk(-NPAGES*PGSIZE);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sysinfo s0, s1;
+  int cpus[NCPU], ncpu = 0;
+  int pages[NCPU], ticks[NCPU], nworker[NCPU];
+  int nproc, xstatus, failed = 0;
+  int fds[2], t0, t1, rep[2];
+
+  // find the CPUs that are online.
+  for(int c = 0; c < NCPU; c++)
+    if(setaffinity(1 << c) == 0)
+      cpus[ncpu++] = c;
+  setaffinity(~0);
+
+  nproc = ncpu;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1){
+    fprintf(2, "usage: kalloctest [nproc]\n");
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("kalloctest: pipe failed\n");
+    exit(1);
+  }
+
+  sysinfo(&s0);
+  t0 = uptime();
+  for(int i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("kalloctest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      int start;
+
+      close(fds[0]);
+      setaffinity(1 << cpus[i % ncpu]);
+      start = uptime();
+      churn(i);
+      rep[0] = cpus[i % ncpu];
+      rep[1] = uptime() - start;
+      write(fds[1], rep, sizeof(rep));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(int c = 0; c < NCPU; c++)
+    pages[c] = ticks[c] = nworker[c] = 0;
+  while(read(fds[0], rep, sizeof(rep)) == sizeof(rep)){
+    pages[rep[0]] += ROUNDS*NPAGES;
+    ticks[rep[0]] += rep[1];
+    nworker[rep[0]]++;
+  }
+  close(fds[0]);
+  for(int i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      failed = 1;
+  }
+  t1 = uptime();
+  sysinfo(&s1);
+
+  if(t1 == t0)
+    t1 = t0 + 1;
+  printf("kalloctest: %d procs on %d cpus, %d pages in %d ticks, %d pages/tick\n",
+         nproc, ncpu, nproc*ROUNDS*NPAGES, t1 - t0,
+         nproc*ROUNDS*NPAGES / (t1 - t0));
+  for(int c = 0; c < NCPU; c++){
+    if(nworker[c] == 0)
+      continue;
+    // each worker's rate, averaged over the CPU's workers.
+    printf("cpu %d: %d procs, %d pages/tick each\n", c, nworker[c],
+           pages[c] / (ticks[c] ? ticks[c] : 1));
+  }
+  printf("kmem: %d acquires, %d contended, %d steals\n",
+         (int)(s1.kmem_acquire - s0.kmem_acquire),
+         (int)(s1.kmem_contend - s0.kmem_contend),
+         (int)(s1.kmem_steal - s0.kmem_steal));
+  printf("free blocks by size (KB):");
+  for(int k = 0; k < NKORDER; k++)
+    printf(" %d:%d", 4 << k, (int)s1.kmem_blocks[k]);
+  printf("\n");
+  if(s1.freemem < s0.freemem)
+    printf("kalloctest: lost %d free pages\n",
+           (int)((s0.freemem - s1.freemem) / PGSIZE));
+  exit(failed);
+}
@@ -0,0 +1,117 @@
+// Time workloads that spend much of their kernel time
+// copying and clearing memory: fork with copy-on-write
+// faults, fresh zero-filled pages from sbrk, and large
+// transfers through a pipe.
+//
+// usage: membench
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGES 64       // pages touched per fork / sbrk round
+#define ROUNDS 50
+#define PIPEBYTES (4*1024*1024)
+
+char buf[8192];
+
+// fork children that write every page of a region they
+// share copy-on-write with the parent.
+int
+forkbench(char *mem)
+{
+  int t0 = uptime();
+
+  for(int r = 0; r < ROUNDS; r++){
+    int pid = fork();
+    if(pid < 0){
+      printf("membench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      for(int i = 0; i < NPAGES; i++)
+        mem[i*PGSIZE] = r;
+      exit(0);
+    }
+    wait(0);
+  }
+  return uptime() - t0;
+}
+
+// grow and shrink the heap, touching each new page.
+int
+sbrkbench(void)
+{
+  int t0 = uptime();
+
+  for(int r = 0; r < ROUNDS; r++){
+    char *p = sbrk(NPAGES*PGSIZE);
+    if(p == (char*)-1){
+      printf("membench: sbrk failed\n");
+      exit(1);
+    }
+    for(int i = 0; i < NPAGES; i++)
+      p[i*PGSIZE] = r;
+    sbrk(-NPAGES*PGSIZE);
+  }
+  return uptime() - t0;
+}
+
+// push PIPEBYTES through a pipe in large writes.
+int
+pipebench(void)
+{
+  int fds[2], n, total, t0;
+
+  if(pipe(fds) < 0){
+    printf("membench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  int pid = fork();
+  if(pid < 0){
+    printf("membench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(total = 0; total < PIPEBYTES; total += sizeof(buf)){
+      if(write(fds[1], buf, sizeof(buf)) != sizeof(buf)){
+        printf("membench: pipe write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    total += n;
+  close(fds[0]);
+  wait(0);
+  if(total != PIPEBYTES){
+    printf("membench: pipe read %d bytes, expected %d\n", total, PIPEBYTES);
+    exit(1);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *mem = sbrk(NPAGES*PGSIZE);
+
+  if(mem == (char*)-1){
+    printf("membench: sbrk failed\n");
+    exit(1);
+  }
+  memset(mem, 1, NPAGES*PGSIZE);
+
+  printf("membench: fork+cow %d x %d pages: %d ticks\n",
+         ROUNDS, NPAGES, forkbench(mem));
+  printf("membench: sbrk %d x %d pages: %d ticks\n",
+         ROUNDS, NPAGES, sbrkbench());
+  printf("membench: pipe %d KB: %d ticks\n",
+         PIPEBYTES / 1024, pipebench());
+  exit(0);
+}
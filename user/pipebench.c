@@ -0,0 +1,65 @@
+// Measure pipe throughput, dd-style: a child writes count
+// blocks of bs bytes into a pipe, and the parent reads them
+// out with reads of the same size.
+//
+// usage: pipebench [bs [count]]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+char buf[64*1024];
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], bs = 8192, count = 1024;
+  int n, pid, t0, t1, total, xstatus;
+
+  if(argc > 1)
+    bs = atoi(argv[1]);
+  if(argc > 2)
+    count = atoi(argv[2]);
+  if(bs < 1 || bs > sizeof(buf) || count < 1 || count > 0x7fffffff / bs){
+    fprintf(2, "usage: pipebench [bs (1-%d) [count]]\n", sizeof(buf));
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    memset(buf, 'p', bs);
+    for(int i = 0; i < count; i++){
+      if(write(fds[1], buf, bs) != bs){
+        printf("pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, bs)) > 0)
+    total += n;
+  close(fds[0]);
+  wait(&xstatus);
+  t1 = uptime();
+
+  if(xstatus != 0 || total != bs*count){
+    printf("pipebench: read %d bytes, expected %d\n", total, bs*count);
+    exit(1);
+  }
+  if(t1 == t0)
+    t1 = t0 + 1;
+  printf("pipebench: %d KB in %d ticks, %d KB/tick (bs %d)\n",
+         total / 1024, t1 - t0, total / 1024 / (t1 - t0), bs);
+  exit(0);
+}
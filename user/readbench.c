@@ -0,0 +1,80 @@
+// Measure sequential read bandwidth from the disk.
+// Writes a file as large as the file system allows,
+// then reads it back several times with large read()s,
+// and reports how much of the kernel's read-ahead was used.
+// A window argument sets the read-ahead window first.
+//
+// usage: readbench [bufsize [window]]
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define ROUNDS 5
+#define FILESZ (MAXFILE*BSIZE)
+
+char buf[64*BSIZE];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n, bufsz = 16*BSIZE;
+  int t0, t1, total;
+  struct sysinfo s0, s1;
+
+  if(argc > 1)
+    bufsz = atoi(argv[1]);
+  if(bufsz < 1 || bufsz > sizeof(buf) ||
+     (argc > 2 && setreadahead(atoi(argv[2])) < 0)){
+    fprintf(2, "usage: readbench [bufsize (1-%d) [window]]\n", sizeof(buf));
+    exit(1);
+  }
+
+  unlink("readbench.tmp");
+  if((fd = open("readbench.tmp", O_CREATE | O_WRONLY)) < 0){
+    printf("readbench: create failed\n");
+    exit(1);
+  }
+  memset(buf, 'r', sizeof(buf));
+  for(total = 0; total < FILESZ; total += n){
+    n = FILESZ - total < sizeof(buf) ? FILESZ - total : sizeof(buf);
+    if(write(fd, buf, n) != n){
+      printf("readbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  total = 0;
+  sysinfo(&s0);
+  t0 = uptime();
+  for(int r = 0; r < ROUNDS; r++){
+    if((fd = open("readbench.tmp", O_RDONLY)) < 0){
+      printf("readbench: open failed\n");
+      exit(1);
+    }
+    while((n = read(fd, buf, bufsz)) > 0)
+      total += n;
+    close(fd);
+  }
+  t1 = uptime();
+  sysinfo(&s1);
+  unlink("readbench.tmp");
+
+  if(total != ROUNDS*FILESZ){
+    printf("readbench: read %d bytes, expected %d\n", total, ROUNDS*FILESZ);
+    exit(1);
+  }
+  if(t1 == t0)
+    t1 = t0 + 1;
+  printf("readbench: %d KB in %d ticks, %d KB/tick (bufsize %d)\n",
+         total / 1024, t1 - t0, total / 1024 / (t1 - t0), bufsz);
+  s1.ra_issued -= s0.ra_issued;
+  s1.ra_hit -= s0.ra_hit;
+  printf("readbench: window %d, %d blocks read ahead, %d used (%d%%)\n",
+         (int)s1.ra_window, (int)s1.ra_issued, (int)s1.ra_hit,
+         s1.ra_issued ? (int)(s1.ra_hit * 100 / s1.ra_issued) : 0);
+  exit(0);
+}
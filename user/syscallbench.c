@@ -0,0 +1,58 @@
+// Measure the cost of a round trip into the kernel and back,
+// which includes switching satp to the kernel page table and
+// back to the process's. Runs alone and then alongside
+// other processes, so that context switches between address
+// spaces are part of the second measurement.
+//
+// usage: syscallbench [nproc]
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NCALL 100000
+
+// make NCALL getpid() system calls; return elapsed ticks.
+int
+calls(void)
+{
+  int t0 = uptime();
+
+  for(int i = 0; i < NCALL; i++)
+    getpid();
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 4, pids[64];
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > 64){
+    fprintf(2, "usage: syscallbench [nproc (1-64)]\n");
+    exit(1);
+  }
+
+  printf("syscallbench: %d getpid calls: %d ticks\n", NCALL, calls());
+
+  // children that also make system calls, keeping the
+  // scheduler moving between address spaces.
+  for(int i = 0; i < nproc; i++){
+    if((pids[i] = fork()) < 0){
+      printf("syscallbench: fork failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0){
+      for(;;)
+        getpid();
+    }
+  }
+  printf("syscallbench: %d getpid calls with %d busy procs: %d ticks\n",
+         NCALL, nproc, calls());
+  for(int i = 0; i < nproc; i++){
+    kill(pids[i]);
+    wait(0);
+  }
+  exit(0);
+}
@@ -1,4 +1,5 @@
 struct stat;
+struct sysinfo;
 
 // system calls
 int fork(void);
@@ -22,6 +23,18 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int sysinfo(struct sysinfo*);
+int setaffinity(int);
+int setreadahead(int);
+int fsync(int);
+void* mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int shmget(int, uint64);
+void* shmat(int);
+int shmdt(void*);
+int shmrm(int);
+int splice(int, int, int);
+int copy_file_range(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
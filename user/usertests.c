@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -785,6 +786,195 @@ pipe1(char *s)
   }
 }
 
+// splice() a file into a pipe and out of it into another file.
+void
+splicetest(char *s)
+{
+  enum { SZ=5000 };
+  int fds[2], fd, pid, xstatus, i, n, total;
+
+  unlink("splice0");
+  unlink("splice1");
+  fd = open("splice0", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create splice0 failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 253;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write splice0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splice0", O_RDONLY);
+    if(splice(fd, fd, 10) >= 0)
+      exit(2);
+    for(total = 0; (n = splice(fd, fds[1], 1000)) > 0; total += n)
+      ;
+    exit(n == 0 && total == SZ ? 0 : 1);
+  }
+  close(fds[1]);
+  fd = open("splice1", O_CREATE|O_WRONLY);
+  for(total = 0; (n = splice(fds[0], fd, SZ)) > 0; total += n)
+    ;
+  close(fds[0]);
+  close(fd);
+  wait(&xstatus);
+  if(xstatus != 0 || n != 0 || total != SZ){
+    printf("%s: splice moved %d bytes, child status %d\n", s, total, xstatus);
+    exit(1);
+  }
+  fd = open("splice1", O_RDONLY);
+  for(total = 0; (n = read(fd, buf, BUFSZ)) > 0; total += n){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (total + i) % 253){
+        printf("%s: wrong byte at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  if(total != SZ){
+    printf("%s: splice1 has %d bytes\n", s, total);
+    exit(1);
+  }
+  unlink("splice0");
+  unlink("splice1");
+}
+
+// copy_file_range() a file larger than one log transaction.
+void
+copyrange(char *s)
+{
+  enum { SZ=40*BSIZE+100 };
+  int fd0, fd1, fds[2], i, n, total;
+
+  unlink("copy0");
+  unlink("copy1");
+  fd0 = open("copy0", O_CREATE|O_RDWR);
+  if(fd0 < 0){
+    printf("%s: create copy0 failed\n", s);
+    exit(1);
+  }
+  for(total = 0; total < SZ; total += n){
+    n = SZ - total < BUFSZ ? SZ - total : BUFSZ;
+    for(i = 0; i < n; i++)
+      buf[i] = (total + i) % 251;
+    if(write(fd0, buf, n) != n){
+      printf("%s: write copy0 failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd0);
+
+  fd0 = open("copy0", O_RDONLY);
+  fd1 = open("copy1", O_CREATE|O_WRONLY);
+  if(fd0 < 0 || fd1 < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(copy_file_range(fd1, fd0, 10) >= 0){
+    printf("%s: copy_file_range into a read-only fd succeeded\n", s);
+    exit(1);
+  }
+  if(copy_file_range(fd0, fd1, 100) != 100 ||
+     copy_file_range(fd0, fd1, 2*SZ) != SZ - 100 ||
+     copy_file_range(fd0, fd1, 10) != 0){
+    printf("%s: copy_file_range copied the wrong amount\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(copy_file_range(fds[0], fd1, 10) >= 0){
+    printf("%s: copy_file_range from a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(fd0);
+  close(fd1);
+
+  fd1 = open("copy1", O_RDONLY);
+  for(total = 0; (n = read(fd1, buf, BUFSZ)) > 0; total += n){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (total + i) % 251){
+        printf("%s: wrong byte at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+  }
+  close(fd1);
+  if(total != SZ){
+    printf("%s: copy1 has %d bytes, expected %d\n", s, total, SZ);
+    exit(1);
+  }
+  unlink("copy0");
+  unlink("copy1");
+}
+
+// single writes and reads larger than the pipe's buffer,
+// wrapping around it at odd offsets.
+void
+pipebig(char *s)
+{
+  enum { SZ=3*4096+17 };
+  int fds[2], pid, xstatus, i, n, total;
+  char *p;
+
+  if((p = sbrk(SZ)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < SZ; i++)
+      p[i] = i % 251;
+    if(write(fds[1], p, 7) != 7 || write(fds[1], p + 7, SZ - 7) != SZ - 7)
+      exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  memset(p, 0, SZ);
+  for(total = 0; (n = read(fds[0], p + total, SZ - total)) > 0; total += n)
+    ;
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || total != SZ){
+    printf("%s: read %d bytes, expected %d\n", s, total, SZ);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(p[i] != (char)(i % 251)){
+      printf("%s: wrong byte %d at %d\n", s, p[i], i);
+      exit(1);
+    }
+  }
+  sbrk(-SZ);
+}
+
 
 // test if child is killed (status = -1)
 void
@@ -1778,6 +1968,41 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// fsync() should accept an open file and wait for the
+// log to commit, and reject a bad file descriptor.
+void
+fsynctest(char *s)
+{
+  int fd;
+
+  unlink("fsync.dat");
+  fd = open("fsync.dat", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create fsync.dat\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 10; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(unlink("fsync.dat") != 0 || fsync(0) != 0){
+    printf("%s: unlink or fsync failed\n", s);
+    exit(1);
+  }
+}
+
 void
 fourteen(char *s)
 {
@@ -1993,6 +2218,112 @@ forktest(char *s)
   }
 }
 
+// check that the process runs on the CPU it is pinned to,
+// across some rescheduling.
+int
+oncpu(int cpu)
+{
+  struct sysinfo info;
+
+  for(int j = 0; j < 10; j++){
+    if(sysinfo(&info) < 0 || info.cpu != cpu)
+      return 0;
+    sleep(0);
+  }
+  return 1;
+}
+
+// a process pinned to one CPU should keep running there,
+// and so should its children.
+void
+affinity(char *s)
+{
+  int pid, xstatus;
+
+  if(setaffinity(0) != -1){
+    printf("%s: setaffinity(0) succeeded\n", s);
+    exit(1);
+  }
+  if(setaffinity(1) != 0){
+    printf("%s: setaffinity(1) failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(oncpu(0) ? 0 : 1);
+  }
+  for(int i = 0; i < 4; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child ran off CPU 0\n", s);
+      exit(1);
+    }
+  }
+  // each online CPU in turn.
+  for(int cpu = 0; cpu < NCPU; cpu++){
+    if(setaffinity(1 << cpu) < 0)
+      continue;
+    if(!oncpu(cpu)){
+      printf("%s: not running on CPU %d\n", s, cpu);
+      exit(1);
+    }
+  }
+  if(setaffinity(~0) != 0){
+    printf("%s: setaffinity(~0) failed\n", s);
+    exit(1);
+  }
+}
+
+// fork() of a process holding more than half of physical
+// memory only works if fork shares pages copy-on-write.
+// stores by the child must not be visible to the parent.
+void
+cowfork(char *s)
+{
+  enum { SZ = 70*1024*1024 };
+  char *a, *p;
+  int pid, xstatus;
+
+  a = sbrk(SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + SZ; p += PGSIZE)
+    *(int*)p = (int)(uint64)p;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + SZ; p += 16*PGSIZE){
+      if(*(int*)p != (int)(uint64)p){
+        printf("%s: child read wrong value\n", s);
+        exit(1);
+      }
+      *(int*)p = -1;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(p = a; p < a + SZ; p += PGSIZE){
+    if(*(int*)p != (int)(uint64)p){
+      printf("%s: child's store leaked into parent\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-SZ);
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2117,6 +2448,582 @@ sbrkmuch(char *s)
   }
 }
 
+// sbrk() should only reserve address space. allocate
+// 100 MB, touch 1% of it, and check that touched pages
+// keep their contents (also across fork) while
+// untouched ones read as zero.
+void
+sbrklazy(char *s)
+{
+  enum { BIG=100*1024*1024, STRIDE=100*PGSIZE };
+  char *a, *p;
+  int pid, xstatus;
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%d) failed\n", s, BIG);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += STRIDE)
+    *p = 'x';
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + BIG; p += STRIDE){
+      if(*p != 'x'){
+        printf("%s: child lost a touched page\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  for(p = a; p < a + BIG; p += STRIDE){
+    if(*p != 'x' || p[PGSIZE] != 0){
+      printf("%s: wrong contents at %p\n", s, p);
+      exit(1);
+    }
+  }
+  if(sbrk(-BIG) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(-%d) failed\n", s, BIG);
+    exit(1);
+  }
+}
+
+// a heap big enough for the kernel to back with megapages
+// must still behave page by page: shrinking it part way
+// through a megapage, and sharing it copy-on-write.
+void
+sbrkmega(char *s)
+{
+  enum { MEGA=2*1024*1024, BIG=3*MEGA };
+  char *a, *p;
+  int pid, xstatus;
+  uint64 top;
+
+  // start at a megapage boundary.
+  top = (uint64)sbrk(0);
+  if(sbrk(MEGA - top % MEGA) == (char*)0xffffffffffffffffL ||
+     (a = sbrk(BIG)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += PGSIZE)
+    *p = (p - a) / PGSIZE;
+
+  // drop the top half of the last megapage.
+  if(sbrk(-MEGA/2) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + BIG - MEGA/2; p += PGSIZE)
+      *p = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  for(p = a; p < a + BIG - MEGA/2; p += PGSIZE){
+    if(*p != (char)((p - a) / PGSIZE)){
+      printf("%s: wrong contents at %p\n", s, p);
+      exit(1);
+    }
+  }
+  sbrk(-(BIG - MEGA/2));
+}
+
+// exec() leaves the program's pages to be read in when first
+// touched. check that initialized data arrives intact in a
+// fork child, after a store, and when the kernel copies it
+// to or from a pipe or from this program's own file, and
+// that the file can't be changed while the program runs.
+char demanddata[4*PGSIZE] = { [0] = 'a', [PGSIZE] = 'b', [2*PGSIZE] = 'c',
+                              [3*PGSIZE] = 'd' };
+
+void
+demandexec(char *s)
+{
+  int fd, fds[2], pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(demanddata[PGSIZE] != 'b'){
+      printf("%s: child read %x, not b\n", s, demanddata[PGSIZE]);
+      exit(1);
+    }
+    demanddata[PGSIZE] = 'x';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], &demanddata[2*PGSIZE], 1) != 1 ||
+     read(fds[0], &demanddata[0], 1) != 1){
+    printf("%s: pipe copy failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(demanddata[0] != 'c' || demanddata[PGSIZE] != 'b'){
+    printf("%s: wrong data %x %x\n", s, demanddata[0], demanddata[PGSIZE]);
+    exit(1);
+  }
+
+  // the page read into must come from the file being read.
+  if((fd = open("usertests", O_RDONLY)) < 0){
+    printf("%s: open usertests failed\n", s);
+    exit(1);
+  }
+  if(read(fd, &demanddata[3*PGSIZE], 4) != 4 ||
+     memcmp(&demanddata[3*PGSIZE], "\x7f" "ELF", 4) != 0){
+    printf("%s: read of own file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("usertests", O_WRONLY)) >= 0){
+    printf("%s: opened running program for writing\n", s);
+    exit(1);
+  }
+}
+
+// copy program src to file dst, replacing its contents.
+void
+copyprog(char *s, char *src, char *dst)
+{
+  int fd0, fd1, n;
+
+  fd0 = open(src, O_RDONLY);
+  fd1 = open(dst, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd0 < 0 || fd1 < 0){
+    printf("%s: open %s or %s failed\n", s, src, dst);
+    exit(1);
+  }
+  while((n = read(fd0, buf, sizeof(buf))) > 0){
+    if(write(fd1, buf, n) != n){
+      printf("%s: write %s failed\n", s, dst);
+      exit(1);
+    }
+  }
+  close(fd0);
+  close(fd1);
+}
+
+// run prog with argument arg, and check that it prints want.
+void
+runprog(char *s, char *prog, char *arg, char *want)
+{
+  char *argv[] = { prog, arg, 0 };
+  char out[32];
+  int fds[2], pid, n, tot, xstatus;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    dup(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    exec(prog, argv);
+    printf("%s: exec %s failed\n", s, prog);
+    exit(1);
+  }
+  close(fds[1]);
+  tot = 0;
+  while(tot < sizeof(out) - 1 && (n = read(fds[0], out + tot, sizeof(out) - 1 - tot)) > 0)
+    tot += n;
+  out[tot] = 0;
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || strcmp(out, want) != 0){
+    printf("%s: %s printed \"%s\", not \"%s\"\n", s, prog, out, want);
+    exit(1);
+  }
+}
+
+// the text page cache keeps a program's pages after it exits.
+// rewrite the program's file with another program, which must
+// make the cached pages stale, and check that the new program
+// is what runs next.
+void
+textcache(char *s)
+{
+  int fd;
+
+  fd = open("tcachein", O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0 || write(fd, "cat\n", 4) != 4){
+    printf("%s: create tcachein failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  copyprog(s, "echo", "tcache");
+  runprog(s, "tcache", "tcachein", "tcachein\n");
+  runprog(s, "tcache", "tcachein", "tcachein\n");  // from the cache
+  copyprog(s, "cat", "tcache");
+  runprog(s, "tcache", "tcachein", "cat\n");
+
+  unlink("tcache");
+  unlink("tcachein");
+}
+
+// mmap(): zeroed anonymous memory, unmapping a hole, a shared
+// file mapping written back by munmap(), and shared versus
+// private anonymous memory across fork().
+void
+mmaptest(char *s)
+{
+  char *p, *q, buf[512];
+  int fd, pid, xstatus, n;
+  struct stat st;
+
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 0 || p[3*PGSIZE-1] != 0){
+    printf("%s: anonymous memory not zeroed\n", s);
+    exit(1);
+  }
+  p[0] = 'a';
+  p[2*PGSIZE] = 'c';
+  if(munmap(p + PGSIZE, PGSIZE) < 0 || p[0] != 'a' || p[2*PGSIZE] != 'c'){
+    printf("%s: munmap of a hole failed\n", s);
+    exit(1);
+  }
+  if(munmap(p, 3*PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmapfile failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(int i = 0; i < 9; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write mmapfile failed\n", s);
+      exit(1);
+    }
+  }
+  p = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: file mmap failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'x' || p[9*512-1] != 'x' || p[9*512] != 0){
+    printf("%s: wrong file contents in mapping\n", s);
+    exit(1);
+  }
+  p[0] = 'y';
+  p[PGSIZE+1] = 'z';
+  if(munmap(p, 2*PGSIZE) < 0){
+    printf("%s: munmap of file failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != 9*512){
+    printf("%s: munmap changed the file size\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || buf[0] != 'y'){
+    printf("%s: file not written back\n", s);
+    exit(1);
+  }
+  // skip to the second page, in reads that fit buf.
+  for(int off = 1; off < PGSIZE; off += n){
+    n = PGSIZE - off < sizeof(buf) ? PGSIZE - off : sizeof(buf);
+    if(read(fd, buf, n) != n){
+      printf("%s: short read of mmapfile\n", s);
+      exit(1);
+    }
+  }
+  if(read(fd, buf, 2) != 2 || buf[1] != 'z'){
+    printf("%s: file not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  p[0] = 1;
+  q[0] = 1;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 2;
+    q[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(p[0] != 2 || q[0] != 1){
+    printf("%s: fork shared %d, private %d\n", s, p[0], q[0]);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+  munmap(q, PGSIZE);
+}
+
+// MAP_SHARED pages first touched after fork() are shared too,
+// and write() can take its data from an untouched mapping of
+// the very file it writes to.
+void
+mmapfork(char *s)
+{
+  char *p, buf[16];
+  int fd, pid, xstatus;
+
+  p = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 1;
+    p[PGSIZE] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(p[0] != 1 || p[PGSIZE] != 2){
+    printf("%s: child's stores not shared: %d %d\n", s, p[0], p[PGSIZE]);
+    exit(1);
+  }
+  munmap(p, 2*PGSIZE);
+
+  unlink("mmapfork");
+  fd = open("mmapfork", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmapfork failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write mmapfork failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: file mmap failed\n", s);
+    exit(1);
+  }
+  if(write(fd, p, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write from mapping of the same file failed\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: file mmap failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 'c';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(p[0] != 'c' || p[sizeof(buf)] != 'x'){
+    printf("%s: child's store to file page not shared\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+  close(fd);
+
+  fd = open("mmapfork", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || buf[0] != 'c'){
+    printf("%s: file not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfork");
+}
+
+// separate MAP_SHARED mappings of a file, made by different
+// processes, share its pages, and see write()s to it; writing
+// the pages back loses neither.
+void
+mmapshare(char *s)
+{
+  char *p, *q, buf[4];
+  int fd, pid, xstatus;
+
+  unlink("mmapshare");
+  fd = open("mmapshare", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "xxxx", 4) != 4){
+    printf("%s: create mmapshare failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  p[0] = 'a';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    int cfd = open("mmapshare", O_RDWR);
+    q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, cfd, 0);
+    if(q == (char*)-1 || q[0] != 'a'){
+      printf("%s: second mapping doesn't see the first's store\n", s);
+      exit(1);
+    }
+    q[1] = 'b';
+    munmap(q, PGSIZE);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(p[1] != 'b'){
+    printf("%s: first mapping doesn't see the second's store\n", s);
+    exit(1);
+  }
+
+  // fd's offset is at the end of the file.
+  if(write(fd, "d", 1) != 1 || p[4] != 'd'){
+    printf("%s: mapping doesn't see write()\n", s);
+    exit(1);
+  }
+  p[2] = 'c';
+  munmap(p, PGSIZE);
+  close(fd);
+
+  fd = open("mmapshare", O_RDONLY);
+  if(read(fd, buf, 4) != 4 || memcmp(buf, "abcx", 4) != 0 ||
+     read(fd, buf, 4) != 1 || buf[0] != 'd'){
+    printf("%s: stores or write lost in write-back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapshare");
+}
+
+// shared-memory segments, attached by key and across fork().
+void
+shmtest(char *s)
+{
+  char *p, *q;
+  int id, pid, xstatus;
+
+  id = shmget(0x5a5a, 2*PGSIZE);
+  if(id < 0 || (p = shmat(id)) == (char*)-1){
+    printf("%s: shmget/shmat failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 0 || p[2*PGSIZE-1] != 0){
+    printf("%s: segment not zeroed\n", s);
+    exit(1);
+  }
+  if(shmget(0x5a5a, 4*PGSIZE) >= 0){
+    printf("%s: shmget of a larger size succeeded\n", s);
+    exit(1);
+  }
+  p[0] = 'a';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // both the inherited attachment and a new one by key.
+    if(shmget(0x5a5a, PGSIZE) != id || (q = shmat(id)) == (char*)-1 || q == p)
+      exit(1);
+    if(q[0] != 'a')
+      exit(2);
+    q[PGSIZE] = 'b';
+    p[1] = 'c';
+    exit(shmdt(q) < 0 ? 3 : 0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed with %d\n", s, xstatus);
+    exit(1);
+  }
+  if(p[PGSIZE] != 'b' || p[1] != 'c'){
+    printf("%s: child's stores not seen\n", s);
+    exit(1);
+  }
+  if(shmrm(id) < 0){
+    printf("%s: shmrm failed\n", s);
+    exit(1);
+  }
+  if(shmat(id) != (char*)-1 || shmrm(id) >= 0){
+    printf("%s: removed segment still usable\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a'){
+    printf("%s: removed segment lost while attached\n", s);
+    exit(1);
+  }
+  if(shmdt(p + PGSIZE) >= 0 || shmdt(p) < 0){
+    printf("%s: shmdt failed\n", s);
+    exit(1);
+  }
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2594,6 +3501,9 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipebig, "pipebig"},
+  {splicetest, "splicetest"},
+  {copyrange, "copyrange"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2613,13 +3523,24 @@ struct test {
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
+  {fsynctest, "fsynctest"},
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
   {iref, "iref"},
   {forktest, "forktest"},
+  {cowfork, "cowfork"},
+  {affinity, "affinity"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
+  {sbrklazy, "sbrklazy"},
+  {sbrkmega, "sbrkmega"},
+  {demandexec, "demandexec"},
+  {textcache, "textcache"},
+  {mmaptest, "mmaptest"},
+  {mmapfork, "mmapfork"},
+  {mmapshare, "mmapshare"},
+  {shmtest, "shmtest"},
   {kernmem, "kernmem"},
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
@@ -36,3 +36,15 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("sysinfo");
+entry("setaffinity");
+entry("setreadahead");
+entry("fsync");
+entry("mmap");
+entry("munmap");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
+entry("shmrm");
+entry("splice");
+entry("copy_file_range");